@@ -43,6 +43,10 @@
 
 
 #include "logging/crc32c.h"
+#include "logging/crc32cgf2.h"
+#include "logging/crc32cload.h"
+#include "logging/crc32ctail.h"
+#include "logging/crc32ctuning.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -147,15 +151,60 @@ static inline uint32_t crc32c_shift ( uint32_t zeros[][256], uint32_t crc )
                zeros[2][ ( crc >> 16 ) & 0xff] ^ zeros[3][crc >> 24];
 }
 
+/* Multiply a and b modulo the CRC-32C polynomial.  Both are polynomials in
+   reversed bit order, like the crcs themselves: the most significant bit is
+   the coefficient of x^0. */
+uint32_t crc32c_multiply ( uint32_t a, uint32_t b )
+{
+        uint32_t m, p;
+
+        p = 0;
+        for ( m = ( uint32_t ) 1 << 31; m; m >>= 1 ) {
+                if ( a & m )
+                        p ^= b;
+                b = ( b & 1 ) ? ( b >> 1 ) ^ POLY : b >> 1;
+        }
+        return p;
+}
+
+/* Return a^n modulo the CRC-32C polynomial, by squaring and multiplying. */
+uint32_t crc32c_pow ( uint32_t a, size_t n )
+{
+        uint32_t p;
+
+        p = ( uint32_t ) 1 << 31;               /* x^0 */
+        while ( n ) {
+                if ( n & 1 )
+                        p = crc32c_multiply ( p, a );
+                a = crc32c_multiply ( a, a );
+                n >>= 1;
+        }
+        return p;
+}
+
+/* Return x^n modulo the CRC-32C polynomial, in reversed bit order.  Shifting
+   a crc by n zero bits is a multiplication by this value. */
+uint32_t crc32c_x_pow ( size_t n )
+{
+        return crc32c_pow ( ( uint32_t ) 1 << 30, n );
+}
+
+/* x^-1 modulo the CRC-32C polynomial, in reversed bit order.  The polynomial
+   has a constant term, so x has an inverse: crc32c_multiply ( x, XINV ) is 1. */
+#define XINV 0x05ec76f1
+
+/* Return x^-n modulo the CRC-32C polynomial, in reversed bit order.
+   Multiplying by this value undoes a shift by n zero bits. */
+uint32_t crc32c_x_pow_inverse ( size_t n )
+{
+        return crc32c_pow ( XINV, n );
+}
+
 /* Block sizes for three-way parallel crc computation.  LONG and SHORT must
-   both be powers of two.  The associated string constants must be set
-   accordingly, for use in constructing the assembler instructions. */
-#define LONG 8192
-#define LONGx1 "8192"
-#define LONGx2 "16384"
-#define SHORT 256
-#define SHORTx1 "256"
-#define SHORTx2 "512"
+   both be powers of two and multiples of 32.  They are taken from the CPU
+   tuning table when the tables below are built. */
+static size_t LONG;
+static size_t SHORT;
 
 /* Tables for hardware crc that shift a crc by LONG and SHORT zeros. */
 static uint32_t crc32c_long[4][256];
@@ -165,36 +214,40 @@ static uint32_t crc32c_short[4][256];
 static void crc32c_init_hw ( void ) __attribute__ ( ( constructor ) );
 static void crc32c_init_hw ( void )
 {
+        const CRC32CTuning &tuning = crc32cTuning();
+        LONG = tuning.adlerLong;
+        SHORT = tuning.adlerShort;
         crc32c_zeros ( crc32c_long, LONG );
         crc32c_zeros ( crc32c_short, SHORT );
 }
 
 #ifndef __LP64__
 #define CRCtriplet(crc, buf, size, i) \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *(uint32_t*) (buf + i)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *(uint32_t*) (buf + i + size)); \
-    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, *(uint32_t*) (buf + i + 2 * size)); \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *(uint32_t*) (buf + sizeof(uint32_t) + i)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *(uint32_t*) (buf + sizeof(uint32_t) + i + size)); \
-    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, *(uint32_t*) (buf + sizeof(uint32_t) + i + 2 * size));
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32(buf + i)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32(buf + i + size)); \
+    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, crc32c_load_u32(buf + i + 2 * size)); \
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32(buf + sizeof(uint32_t) + i)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32(buf + sizeof(uint32_t) + i + size)); \
+    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, crc32c_load_u32(buf + sizeof(uint32_t) + i + 2 * size));
 #else
 #define CRCtriplet(crc, buf, size, i) \
-    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, *(uint64_t*) (buf + i)); \
-    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, *(uint64_t*) (buf + i + size)); \
-    crc ## 2 = __builtin_ia32_crc32di(crc ## 2, *(uint64_t*) (buf + i + 2 * size));
+    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, crc32c_load_u64(buf + i)); \
+    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, crc32c_load_u64(buf + i + size)); \
+    crc ## 2 = __builtin_ia32_crc32di(crc ## 2, crc32c_load_u64(buf + i + 2 * size));
 #endif
 
 
 #ifndef __LP64__
 #define CRCsinglet(crc, buf) \
-    crc = __builtin_ia32_crc32si(crc, *(uint32_t*)buf); \
-    crc = __builtin_ia32_crc32si(crc, *(uint32_t*)(buf + sizeof(uint32_t))); \
+    crc = __builtin_ia32_crc32si(crc, crc32c_load_u32(buf)); \
+    crc = __builtin_ia32_crc32si(crc, crc32c_load_u32(buf + sizeof(uint32_t))); \
     buf+= 2 *sizeof(uint32_t);
 #else
-#define CRCsinglet(crc, buf) crc = __builtin_ia32_crc32di(crc, *(uint64_t*)buf); buf+= sizeof(uint64_t);
+#define CRCsinglet(crc, buf) crc = __builtin_ia32_crc32di(crc, crc32c_load_u64(buf)); buf+= sizeof(uint64_t);
 #endif
 
 /* Compute CRC-32C using the Intel hardware instruction. */
+CRC32C_TARGET_SSE42
 uint32_t crc32cAdler ( uint32_t crc, const void *buf, size_t len )
 {
         const unsigned char *next = ( const unsigned char * ) buf;
@@ -206,30 +259,24 @@ uint32_t crc32cAdler ( uint32_t crc, const void *buf, size_t len )
 #endif
         uint32_t crc32bit;
 
+        // the head and tail below load a whole quadword, so tiny buffers go separately
+        if ( len < 8 ) {
+                return crc32c_shift_short ( crc, ( const char * ) next, len );
+        }
         crc32bit = crc;
-        // in len > 256 compute the crc for up to seven leading bytes to bring the data pointer to an eight-byte boundary
+        // in len > 128 compute the crc for up to seven leading bytes to bring the data pointer to an eight-byte boundary,
+        // with one load and no branch on their number
         if ( len > 128 ) {
-                unsigned char align = ( 8 - ( uintptr_t ) next ) % 8;            // byte to boundary
+                size_t align = ( 8 - ( uintptr_t ) next ) % 8;            // byte to boundary
+                crc32bit = crc32c_shift_head ( crc32bit, ( const char * ) next, align );
                 len -= align;
-                if ( ( align % 2 ) != 0 ) crc32bit = __builtin_ia32_crc32qi ( crc32bit, *next );
                 next += align;
-                switch ( align / 2 ) {
-                case 3:
-                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) ( next - 6 ) ); // 6 char, remain 4
-                case 2:
-                        crc32bit = __builtin_ia32_crc32si ( crc32bit, * ( uint32_t* ) ( next - 4 ) ); // 4 char, remain 0
-                        break;
-                case 1:
-                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) ( next - 2 ) ); // 2 char, remain 0
-                case 0:
-                        break;
-                }
         };
 
         /* compute the crc on sets of LONG*3 bytes, executing three independent crc
-           instructions, each on LONG bytes -- this is optimized for the Nehalem,
-           Westmere, Sandy Bridge, and Ivy Bridge architectures, which have a
-           throughput of one crc per cycle, but a latency of three cycles */
+           instructions, each on LONG bytes -- this hides the latency of three
+           cycles of crc32 on cores with a throughput of one crc per cycle; LONG
+           and SHORT are tuned per microarchitecture in crc32ctuning.cc */
 
         crc0 = crc32bit;
         while ( len >= LONG*3 ) {
@@ -272,11 +319,11 @@ uint32_t crc32cAdler ( uint32_t crc, const void *buf, size_t len )
            block */
 
         // use Duff's device, a for() loop inside a switch() statement. This is Legal
-        unsigned short count;
+        size_t count;
         if ( ( count = ( len - ( len & 7 ) ) ) >= 8 ) { // needs to execute crc at least once
                 len -= count;
                 count /= 8;                        // count number of crc32di
-                unsigned short n = ( count + 15 ) / 16;
+                size_t n = ( count + 15 ) / 16;
                 switch ( count % 16 ) {
                 case 0:
                         do {
@@ -315,23 +362,9 @@ uint32_t crc32cAdler ( uint32_t crc, const void *buf, size_t len )
                 }
         };
 
-        /* compute the crc for up to seven trailing bytes */
-        crc32bit = crc0;
-        if ( ( len % 2 ) != 0 ) crc32bit = __builtin_ia32_crc32qi ( crc32bit, * ( next ) ); // 1 char, remain even
-        next += len;
-        switch ( len / 2 ) {
-        case 3:
-                crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) ( next - 6 ) ); // 2 char, remain 4
-        case 2:
-                crc32bit = __builtin_ia32_crc32si ( crc32bit, * ( uint32_t* ) ( next - 4 ) ); // 4 char, remain 0
-                break;
-        case 1:
-                crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) ( next - 2 ) ); // 2 char, remain 0
-                break;
-        case 0:
-                break;
-        }
-        return ( uint32_t ) crc32bit;
+        /* compute the crc for up to seven trailing bytes, looking back over the
+           last quadword of the buffer instead of switching on their number */
+        return crc32c_shift_tail ( ( uint32_t ) crc0, ( const char * ) next + len, len );
 }
 
 }  // namespace logging
@@ -10,19 +10,57 @@
 #include <cpuid.h>
 
 
+#include "logging/crc32cgf2.h"
+#include "logging/crc32cload.h"
+#include "logging/crc32cstats.h"
 #include "logging/crc32ctables.h"
+#include "logging/crc32ctail.h"
 
 namespace logging {
 
 static uint32_t crc32c_CPUDetection(uint32_t crc, const void* data, size_t length) {
     // Avoid issues that could potentially be caused by multiple threads: use a local variable
-    CRC32CFunctionPtr best = detectBestCRC32C();
+    CRC32CFunctionPtr best = crc32cStatsSelect(detectBestCRC32C());
     crc32c = best;
     return best(crc, data, length);
 }
 
 CRC32CFunctionPtr crc32c = crc32c_CPUDetection;
 
+#ifndef bit_VPCLMULQDQ
+#define bit_VPCLMULQDQ  (1 << 10)
+#endif
+
+bool crc32cHasPCLMULQDQ() {
+    unsigned int eax, ebx, ecx = 0, edx;
+    if (__get_cpuid_max(0, NULL) >= 1) {
+        __cpuid(1, eax, ebx, ecx, edx);
+    }
+    return (ecx & bit_SSE4_2) && (ecx & bit_PCLMUL);
+}
+
+bool crc32cHasVPCLMULQDQ() {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return false;
+    }
+    __cpuid(1, eax, ebx, ecx, edx);
+    // The OS must have enabled AVX state before XGETBV can be asked about YMM
+    if ((ecx & (bit_OSXSAVE | bit_AVX | bit_PCLMUL | bit_SSE4_2)) !=
+            (bit_OSXSAVE | bit_AVX | bit_PCLMUL | bit_SSE4_2)) {
+        return false;
+    }
+    unsigned int xcr0_low, xcr0_high;
+    __asm__ ("xgetbv" : "=a" (xcr0_low), "=d" (xcr0_high) : "c" (0));
+    // XMM and YMM state
+    if ((xcr0_low & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & bit_AVX2) && (ecx & bit_VPCLMULQDQ);
+}
+
 CRC32CFunctionPtr detectBestCRC32C() {
     unsigned int eax, ebx = 0, ecx = 0, edx;
     unsigned int max_level;
@@ -31,16 +69,35 @@ CRC32CFunctionPtr detectBestCRC32C() {
     if (max_level >= 1) {
         __cpuid(1, eax, ebx, ecx, edx);
     };
-    bool hasSSE42 = (ecx & bit_SSE4_2);
-    if (hasSSE42) {
+    // crc32cHardware32/64 only need the crc32 instruction, so the first SSE4.2
+    // parts (Nehalem), which have no pclmulqdq, still get a hardware kernel
+    if (!(ecx & bit_SSE4_2)) {
+        return crc32cBraided;
+    }
 #ifdef __LP64__
-        return crc32cHardware64;
+    if (crc32cHasVPCLMULQDQ()) {
+        return crc32c_vpclmul_avx2;
+    }
+    return crc32cHardware64;
 #else
-        return crc32cHardware32;
+    return crc32cHardware32;
 #endif
-    } else {
-        return crc32cSlicingBy8;
-    }
+}
+
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2) {
+    // crc1 followed by length2 zero bytes is crc1 * x^(8 * length2). The power is
+    // taken of x^8 rather than of x, so that 8 * length2 cannot overflow a 32-bit
+    // size_t.
+    return crc32c_multiply(crc1, crc32c_pow(crc32c_x_pow(8), length2)) ^ crc2;
+}
+
+uint32_t crc32c_truncate(uint32_t crc_full, size_t len_full, const void* tail_bytes, size_t tail_len) {
+    assert(tail_len <= len_full);
+    (void) len_full;
+    // crc32cCombine run backwards: xoring out the tail's CRC leaves the prefix's
+    // CRC shifted by tail_len zero bytes, which x^(-8 * tail_len) shifts back
+    uint32_t crc_tail = crc32cFinish(crc32c(crc32cInit(), tail_bytes, tail_len));
+    return crc32c_multiply(crc_full ^ crc_tail, crc32c_pow(crc32c_x_pow_inverse(8), tail_len));
 }
 
 // Implementations adapted from Intel's Slicing By 8 Sourceforge Project
@@ -81,7 +138,7 @@ uint32_t crc32cSlicingBy4(uint32_t crc, const void* data, size_t length) {
     size_t end_bytes = length - running_length; 
 
     for (size_t li = 0; li < running_length/4; li++) {
-        crc ^= *(uint32_t*) p_buf;
+        crc ^= crc32c_load_u32(p_buf);
         p_buf += 4;
         uint32_t term1 = crc_tableil8_o56[crc & 0x000000FF] ^
                 crc_tableil8_o48[(crc >> 8) & 0x000000FF];
@@ -113,7 +170,7 @@ uint32_t crc32cSlicingBy8(uint32_t crc, const void* data, size_t length) {
     size_t end_bytes = length - running_length; 
 
     for (size_t li = 0; li < running_length/8; li++) {
-        crc ^= *(uint32_t*) p_buf;
+        crc ^= crc32c_load_u32(p_buf);
         p_buf += 4;
         uint32_t term1 = crc_tableil8_o88[crc & 0x000000FF] ^
                 crc_tableil8_o80[(crc >> 8) & 0x000000FF];
@@ -121,10 +178,10 @@ uint32_t crc32cSlicingBy8(uint32_t crc, const void* data, size_t length) {
         crc = term1 ^
               crc_tableil8_o72[term2 & 0x000000FF] ^ 
               crc_tableil8_o64[(term2 >> 8) & 0x000000FF];
-        term1 = crc_tableil8_o56[(*(uint32_t *)p_buf) & 0x000000FF] ^
-                crc_tableil8_o48[((*(uint32_t *)p_buf) >> 8) & 0x000000FF];
+        term1 = crc_tableil8_o56[crc32c_load_u32(p_buf) & 0x000000FF] ^
+                crc_tableil8_o48[(crc32c_load_u32(p_buf) >> 8) & 0x000000FF];
 
-        term2 = (*(uint32_t *)p_buf) >> 16;
+        term2 = crc32c_load_u32(p_buf) >> 16;
         crc = crc ^ term1 ^
                 crc_tableil8_o40[term2  & 0x000000FF] ^
                 crc_tableil8_o32[(term2 >> 8) & 0x000000FF];
@@ -138,93 +195,151 @@ uint32_t crc32cSlicingBy8(uint32_t crc, const void* data, size_t length) {
     return crc;
 }
 
+// Braided CRC, as in zlib 1.2.12 and later. The buffer is cut into words of 8 bytes
+// which are dealt round-robin to kBraidLanes independent CRCs, so the table lookups
+// of one lane do not wait for those of the others. Each byte of a lane's word is
+// looked up in a table that already moves its contribution forward to the lane's
+// next word, kBraidLanes * 8 bytes later. The lanes are merged in the last block.
+static const size_t kBraidLanes = 4;
+static const size_t kBraidWord = sizeof(uint64_t);
+static const size_t kBraidBlock = kBraidLanes * kBraidWord;
+
+struct BraidTables {
+    // table[k][b]: byte b at offset k of a word, moved to the lane's next word
+    uint32_t table[kBraidWord][256];
+
+    BraidTables() {
+        for (size_t k = 0; k < kBraidWord; ++k) {
+            uint32_t shift = crc32c_x_pow(8 * (kBraidBlock - k - 1));
+            for (size_t b = 0; b < 256; ++b) {
+                table[k][b] = crc32c_multiply(crc_tableil8_o32[b], shift);
+            }
+        }
+    }
+};
+
+static const BraidTables& braidTables() {
+    static const BraidTables tables;
+    return tables;
+}
+
+static inline uint32_t braidWord(const BraidTables& tables, uint64_t word) {
+    return tables.table[0][word & 0xFF] ^
+           tables.table[1][(word >> 8) & 0xFF] ^
+           tables.table[2][(word >> 16) & 0xFF] ^
+           tables.table[3][(word >> 24) & 0xFF] ^
+           tables.table[4][(word >> 32) & 0xFF] ^
+           tables.table[5][(word >> 40) & 0xFF] ^
+           tables.table[6][(word >> 48) & 0xFF] ^
+           tables.table[7][word >> 56];
+}
+
+// The crc of 8 bytes from zero, with the slicing-by-8 tables
+static inline uint32_t crcWord(uint64_t word) {
+    uint32_t low = (uint32_t) word;
+    uint32_t high = (uint32_t) (word >> 32);
+    return crc_tableil8_o88[low & 0xFF] ^
+           crc_tableil8_o80[(low >> 8) & 0xFF] ^
+           crc_tableil8_o72[(low >> 16) & 0xFF] ^
+           crc_tableil8_o64[low >> 24] ^
+           crc_tableil8_o56[high & 0xFF] ^
+           crc_tableil8_o48[(high >> 8) & 0xFF] ^
+           crc_tableil8_o40[(high >> 16) & 0xFF] ^
+           crc_tableil8_o32[high >> 24];
+}
+
+uint32_t crc32cBraided(uint32_t crc, const void* data, size_t length) {
+    const char* p_buf = (const char*) data;
+
+    // Handle leading misaligned bytes
+    size_t initial_bytes = (kBraidWord - (intptr_t)p_buf) & (kBraidWord - 1);
+    if (length < initial_bytes) initial_bytes = length;
+    for (size_t li = 0; li < initial_bytes; li++) {
+        crc = crc_tableil8_o32[(crc ^ *p_buf++) & 0x000000FF] ^ (crc >> 8);
+    }
+    length -= initial_bytes;
+
+    size_t blocks = length / kBraidBlock;
+    if (blocks > 0) {
+        const BraidTables& tables = braidTables();
+        length -= blocks * kBraidBlock;
+
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        uint64_t crc3 = 0;
+        while (--blocks > 0) {
+            uint64_t word0 = crc0 ^ crc32c_load_u64(p_buf);
+            uint64_t word1 = crc1 ^ crc32c_load_u64(p_buf + kBraidWord);
+            uint64_t word2 = crc2 ^ crc32c_load_u64(p_buf + 2 * kBraidWord);
+            uint64_t word3 = crc3 ^ crc32c_load_u64(p_buf + 3 * kBraidWord);
+            p_buf += kBraidBlock;
+            crc0 = braidWord(tables, word0);
+            crc1 = braidWord(tables, word1);
+            crc2 = braidWord(tables, word2);
+            crc3 = braidWord(tables, word3);
+        }
+
+        // The last block runs the lanes one after the other, which merges them
+        crc = crcWord(crc0 ^ crc32c_load_u64(p_buf));
+        crc = crcWord(crc1 ^ crc ^ crc32c_load_u64(p_buf + kBraidWord));
+        crc = crcWord(crc2 ^ crc ^ crc32c_load_u64(p_buf + 2 * kBraidWord));
+        crc = crcWord(crc3 ^ crc ^ crc32c_load_u64(p_buf + 3 * kBraidWord));
+        p_buf += kBraidBlock;
+    }
+
+    for (; length >= kBraidWord; length -= kBraidWord) {
+        crc = crcWord(crc ^ crc32c_load_u64(p_buf));
+        p_buf += kBraidWord;
+    }
+    for (size_t li = 0; li < length; li++) {
+        crc = crc_tableil8_o32[(crc ^ *p_buf++) & 0x000000FF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
 // Hardware-accelerated CRC-32C (using CRC32 instruction)
+CRC32C_TARGET_SSE42
 uint32_t crc32cHardware32(uint32_t crc, const void* data, size_t length) {
     const char* p_buf = (const char*) data;
+    // The tail below looks back over the last 8 bytes, so tiny buffers go separately
+    if (length < sizeof(uint64_t)) {
+        return crc32c_shift_short(crc, p_buf, length);
+    }
     // alignment doesn't seem to help?
     for (size_t i = 0; i < length / sizeof(uint32_t); i++) {
-        crc = __builtin_ia32_crc32si(crc, *(uint32_t*) p_buf);
+        crc = __builtin_ia32_crc32si(crc, crc32c_load_u32(p_buf));
         p_buf += sizeof(uint32_t);
     }
 
-    // This ugly switch is slightly faster for short strings than the straightforward loop
+    // One shifted load and a crc32q instead of a switch: record lengths vary, and
+    // a mispredicted switch costs more than the whole tail. Only crc32 is used, so
+    // this kernel needs no PCLMULQDQ.
     length &= sizeof(uint32_t) - 1;
-    /*
-    while (length > 0) {
-        crc32bit = __builtin_ia32_crc32qi(crc32bit, *p_buf++);
-        length--;
-    }
-    */
-    switch (length) {
-        case 3:
-            crc = __builtin_ia32_crc32qi(crc, *p_buf++);
-        case 2:
-            crc = __builtin_ia32_crc32hi(crc, *(uint16_t*) p_buf);
-            break;
-        case 1:
-            crc = __builtin_ia32_crc32qi(crc, *p_buf);
-            break;
-        case 0:
-            break;
-        default:
-            // This should never happen; enable in debug code
-            assert(false);
-    }
-
-    return crc;
+    return crc32c_shift_tail(crc, p_buf + length, length);
 }
 
 // Hardware-accelerated CRC-32C (using CRC32 instruction)
+CRC32C_TARGET_SSE42
 uint32_t crc32cHardware64(uint32_t crc, const void* data, size_t length) {
 #ifndef __LP64__
     return crc32cHardware32(crc, data, length);
 #else
     const char* p_buf = (const char*) data;
+    if (length < sizeof(uint64_t)) {
+        return crc32c_shift_short(crc, p_buf, length);
+    }
     // alignment doesn't seem to help?
     uint64_t crc64bit = crc;
     for (size_t i = 0; i < length / sizeof(uint64_t); i++) {
-        crc64bit = __builtin_ia32_crc32di(crc64bit, *(uint64_t*) p_buf);
+        crc64bit = __builtin_ia32_crc32di(crc64bit, crc32c_load_u64(p_buf));
         p_buf += sizeof(uint64_t);
     }
 
-    // This ugly switch is slightly faster for short strings than the straightforward loop
-    uint32_t crc32bit = (uint32_t) crc64bit;
+    // See crc32cHardware32 for why there is no switch here
     length &= sizeof(uint64_t) - 1;
-    /*
-    while (length > 0) {
-        crc32bit = __builtin_ia32_crc32qi(crc32bit, *p_buf++);
-        length--;
-    }
-    */
-    switch (length) {
-        case 7:
-            crc32bit = __builtin_ia32_crc32qi(crc32bit, *p_buf++);
-        case 6:
-            crc32bit = __builtin_ia32_crc32hi(crc32bit, *(uint16_t*) p_buf);
-            p_buf += 2;
-        // case 5 is below: 4 + 1
-        case 4:
-            crc32bit = __builtin_ia32_crc32si(crc32bit, *(uint32_t*) p_buf);
-            break;
-        case 3:
-            crc32bit = __builtin_ia32_crc32qi(crc32bit, *p_buf++);
-        case 2:
-            crc32bit = __builtin_ia32_crc32hi(crc32bit, *(uint16_t*) p_buf);
-            break;
-        case 5:
-            crc32bit = __builtin_ia32_crc32si(crc32bit, *(uint32_t*) p_buf);
-            p_buf += 4;
-        case 1:
-            crc32bit = __builtin_ia32_crc32qi(crc32bit, *p_buf);
-            break;
-        case 0:
-            break;
-        default:
-            // This should never happen; enable in debug code
-            assert(false);
-    }
-
-    return crc32bit;
+    return crc32c_shift_tail((uint32_t) crc64bit, p_buf + length, length);
 #endif
 }
 
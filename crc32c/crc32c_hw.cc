@@ -1,5 +1,10 @@
 
 #include "logging/crc32c.h"
+#include "logging/crc32cfixed.h"
+#include "logging/crc32cgf2.h"
+#include "logging/crc32cload.h"
+#include "logging/crc32ctail.h"
+#include "logging/crc32ctuning.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,7 +12,6 @@
 #include <unistd.h>
 #include <assert.h>
 
-#ifdef __SSE4_2__
 #ifdef _MSC_VER
 #include <nmmintrin.h>  // For SSE 4.2
 #include <wnmmintrin.h>  // For SSE 4.2
@@ -15,7 +19,6 @@
 #include <x86intrin.h>
 //#include <nmmintrin.h>  // For SSE 4.2
 #endif // _MSC_VER
-#endif // __SSE4_2__
 
 #ifndef ssize_t
 #define ssize_t ptrdiff_t
@@ -71,54 +74,54 @@
 
 #if CRC32C_IS_X86_64
 
-#define CRC32C_Triplet(crc, buf, offset)                                        \
-    do {                                                                        \
-        crc##0 = _mm_crc32_u64(crc##0, *((uint64_t *)(buf##0) + (offset)));     \
-        crc##1 = _mm_crc32_u64(crc##1, *((uint64_t *)(buf##1) + (offset)));     \
-        crc##2 = _mm_crc32_u64(crc##2, *((uint64_t *)(buf##2) + (offset)));     \
-    } while (0);                                                                \
+#define CRC32C_Triplet(crc, buf, offset)                                                            \
+    do {                                                                                            \
+        crc##0 = _mm_crc32_u64(crc##0, crc32c_load_u64((const char *)(buf##0) + 8 * (offset)));     \
+        crc##1 = _mm_crc32_u64(crc##1, crc32c_load_u64((const char *)(buf##1) + 8 * (offset)));     \
+        crc##2 = _mm_crc32_u64(crc##2, crc32c_load_u64((const char *)(buf##2) + 8 * (offset)));     \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
-#define CRC32C_Duplet(crc, buf, offset)                                         \
-    do {                                                                        \
-        crc##0 = _mm_crc32_u64(crc##0, *((uint64_t *)(buf##0) + (offset)));     \
-        crc##1 = _mm_crc32_u64(crc##1, *((uint64_t *)(buf##1) + (offset)));     \
-    } while (0);                                                                \
+#define CRC32C_Duplet(crc, buf, offset)                                                             \
+    do {                                                                                            \
+        crc##0 = _mm_crc32_u64(crc##0, crc32c_load_u64((const char *)(buf##0) + 8 * (offset)));     \
+        crc##1 = _mm_crc32_u64(crc##1, crc32c_load_u64((const char *)(buf##1) + 8 * (offset)));     \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
-#define CRC32C_Singlet(crc, buf, offset)                                        \
-    do {                                                                        \
-        crc = _mm_crc32_u64(crc, *((uint64_t *)(buf) + offset));                \
-    } while (0);                                                                \
+#define CRC32C_Singlet(crc, buf, offset)                                                            \
+    do {                                                                                            \
+        crc = _mm_crc32_u64(crc, crc32c_load_u64((const char *)(buf) + 8 * (offset)));              \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
 #else // !CRC32C_IS_X86_64
 
-#define CRC32C_Triplet(crc, buf, offset)                                                \
-    do {                                                                                \
-        crc##0 = _mm_crc32_u32(crc##0, *((uint32_t *)(buf##0) + 0 + 2 * (offset)));     \
-        crc##1 = _mm_crc32_u32(crc##1, *((uint32_t *)(buf##1) + 0 + 2 * (offset)));     \
-        crc##2 = _mm_crc32_u32(crc##2, *((uint32_t *)(buf##2) + 0 + 2 * (offset)));     \
-        crc##0 = _mm_crc32_u32(crc##0, *((uint32_t *)(buf##0) + 1 + 2 * (offset)));     \
-        crc##1 = _mm_crc32_u32(crc##1, *((uint32_t *)(buf##1) + 1 + 2 * (offset)));     \
-        crc##2 = _mm_crc32_u32(crc##2, *((uint32_t *)(buf##2) + 1 + 2 * (offset)));     \
-    } while (0);                                                                        \
+#define CRC32C_Triplet(crc, buf, offset)                                                            \
+    do {                                                                                            \
+        crc##0 = _mm_crc32_u32(crc##0, crc32c_load_u32((const char *)(buf##0) + 8 * (offset)));     \
+        crc##1 = _mm_crc32_u32(crc##1, crc32c_load_u32((const char *)(buf##1) + 8 * (offset)));     \
+        crc##2 = _mm_crc32_u32(crc##2, crc32c_load_u32((const char *)(buf##2) + 8 * (offset)));     \
+        crc##0 = _mm_crc32_u32(crc##0, crc32c_load_u32((const char *)(buf##0) + 8 * (offset) + 4)); \
+        crc##1 = _mm_crc32_u32(crc##1, crc32c_load_u32((const char *)(buf##1) + 8 * (offset) + 4)); \
+        crc##2 = _mm_crc32_u32(crc##2, crc32c_load_u32((const char *)(buf##2) + 8 * (offset) + 4)); \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
-#define CRC32C_Duplet(crc, buf, offset)                                                 \
-    do {                                                                                \
-        crc##0 = _mm_crc32_u32(crc##0, *((uint32_t *)(buf##0) + 0 + 2 * (offset)));     \
-        crc##1 = _mm_crc32_u32(crc##1, *((uint32_t *)(buf##1) + 0 + 2 * (offset)));     \
-        crc##0 = _mm_crc32_u32(crc##0, *((uint32_t *)(buf##0) + 1 + 2 * (offset)));     \
-        crc##1 = _mm_crc32_u32(crc##1, *((uint32_t *)(buf##1) + 1 + 2 * (offset)));     \
-    } while (0);                                                                        \
+#define CRC32C_Duplet(crc, buf, offset)                                                             \
+    do {                                                                                            \
+        crc##0 = _mm_crc32_u32(crc##0, crc32c_load_u32((const char *)(buf##0) + 8 * (offset)));     \
+        crc##1 = _mm_crc32_u32(crc##1, crc32c_load_u32((const char *)(buf##1) + 8 * (offset)));     \
+        crc##0 = _mm_crc32_u32(crc##0, crc32c_load_u32((const char *)(buf##0) + 8 * (offset) + 4)); \
+        crc##1 = _mm_crc32_u32(crc##1, crc32c_load_u32((const char *)(buf##1) + 8 * (offset) + 4)); \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
-#define CRC32C_Singlet(crc, buf, offset)                                                \
-    do {                                                                                \
-        crc = _mm_crc32_u32(crc, *((uint32_t *)(buf) + 0 + 2 * (offset)));              \
-        crc = _mm_crc32_u32(crc, *((uint32_t *)(buf) + 1 + 2 * (offset)));              \
-    } while (0);                                                                        \
+#define CRC32C_Singlet(crc, buf, offset)                                                            \
+    do {                                                                                            \
+        crc = _mm_crc32_u32(crc, crc32c_load_u32((const char *)(buf) + 8 * (offset)));              \
+        crc = _mm_crc32_u32(crc, crc32c_load_u32((const char *)(buf) + 8 * (offset) + 4));          \
+    } while (0);                                                                                    \
     CRC32C_FALLTHROUGH
 
 #endif // CRC32C_IS_X86_64
@@ -130,7 +133,7 @@ namespace logging {
 //
 // clang-format off
 //alignas(16)
-static const uint64_t crc32c_clmul_constants[] = {
+const uint64_t crc32c_clmul_constants[256] = {
     0x14cd00bd6ULL, 0x105ec76f0ULL, 0x0ba4fc28eULL, 0x14cd00bd6ULL,
     0x1d82c63daULL, 0x0f20c0dfeULL, 0x09e4addf8ULL, 0x0ba4fc28eULL,
     0x039d3b296ULL, 0x1384aa63aULL, 0x102f9b8a2ULL, 0x1d82c63daULL,
@@ -198,147 +201,152 @@ static const uint64_t crc32c_clmul_constants[] = {
 };
 // clang-format on
 
-#if __SSE4_2__
+//
+// Multipliers for combining four or six streams, generated at startup.
+// crc32c_clmul_shift[q - 1] moves a crc over q quadwords. It has the form of the
+// white-paper table, x^(64 * q - 32) mod P in reversed bit order shifted left by
+// one for pclmulqdq, so entries 2B and B are the pair crc32c_clmul_constants
+// holds for a block of B quadwords.
+//
+static const size_t kMaxStreams = 6;
+static const size_t kMaxStreamBlockSize = 128;
 
-uint32_t crc32c_hw_x86(uint32_t crc, const void * buf, size_t length)
+static uint64_t crc32c_clmul_shift[(kMaxStreams - 1) * kMaxStreamBlockSize];
+
+//
+// crc32c_hw_large() gives each of its three streams a third of a 2 MiB page, in
+// quadwords. crc32c_large_shift is the pair crc32c_clmul_constants would hold for
+// a block of that many quadwords.
+//
+static const size_t kLargePageSize = 2 * 1024 * 1024;
+static const size_t kLargeStreamSize = kLargePageSize / 3 / sizeof(uint64_t);
+
+static uint64_t crc32c_large_shift[2];
+
+static void crc32c_clmul_shift_init() __attribute__((constructor));
+static void crc32c_clmul_shift_init()
 {
-    assert(data != nullptr);
+    static const size_t kNumShifts = sizeof(crc32c_clmul_shift) / sizeof(crc32c_clmul_shift[0]);
+    const uint32_t x64 = crc32c_x_pow(64);
+    uint32_t k = crc32c_x_pow(32);
+    for (size_t q = 1; q <= kNumShifts; ++q) {
+        crc32c_clmul_shift[q - 1] = (uint64_t)k << 1;
+        k = crc32c_multiply(k, x64);
+    }
+    crc32c_large_shift[0] = (uint64_t)crc32c_x_pow(64 * 2 * kLargeStreamSize - 32) << 1;
+    crc32c_large_shift[1] = (uint64_t)crc32c_x_pow(64 * kLargeStreamSize - 32) << 1;
+#ifndef NDEBUG
+    for (size_t block_size = 1; block_size <= kMaxStreamBlockSize; ++block_size) {
+        assert(crc32c_clmul_shift[2 * block_size - 1] == crc32c_clmul_constants[2 * (block_size - 1)]);
+        assert(crc32c_clmul_shift[block_size - 1] == crc32c_clmul_constants[2 * (block_size - 1) + 1]);
+    }
+#endif
+}
 
-    static const ssize_t kStepSize = sizeof(uint32_t);
-    static const uint32_t kMaskOne = 0xFFFFFFFFUL;
+CRC32C_TARGET_HW
+uint32_t crc32c_hw_x86(uint32_t crc, const void * buf, size_t length)
+{
+    assert(buf != nullptr);
 
-    uint32_t crc32 = crc;
+    static const size_t kStepSize = sizeof(uint32_t);
 
     const char * data = (const char *)buf;
-    const char * data_end = (const char *)buf + length;
-    ssize_t remain = length;
-
-    do {
-        if (likely(remain >= kStepSize)) {
-            assert(data < data_end);
-            uint32_t data32 = *(uint32_t *)(data);
-            crc32 = _mm_crc32_u32(crc32, data32);
-            data += kStepSize;
-            remain -= kStepSize;
-        }
-        else {
-            assert((data_end - data) >= 0 && (data_end - data) < kStepSize);
-            assert((data_end - data) == remain);
-            assert(remain >= 0);
-            if (likely(remain > 0)) {
-                uint32_t data32 = *(uint32_t *)(data);
-                uint32_t rest = (uint32_t)(kStepSize - remain);
-                assert(rest > 0 && rest < (uint32_t)kStepSize);
-                uint32_t mask = kMaskOne >> (rest * 8U);
-                data32 &= mask;
-                crc32 = _mm_crc32_u32(crc32, data32);
-            }
-            break;
-        }
-    } while (1);
+    const char * data_end = data + length;
+    if (length < sizeof(uint64_t)) {
+        return crc32c_hw_short(crc, data, length);
+    }
 
-    return crc32;
+    uint32_t crc32 = crc;
+    size_t remain = length;
+    while (likely(remain >= kStepSize)) {
+        crc32 = _mm_crc32_u32(crc32, crc32c_load_u32(data));
+        data += kStepSize;
+        remain -= kStepSize;
+    }
+
+    // Never load past data_end: the buffer may end at an unmapped page
+    assert(data_end - data == (ptrdiff_t)remain);
+    return crc32c_hw_tail(crc32, data_end, remain);
 }
 
+CRC32C_TARGET_HW
 uint32_t crc32c_hw_x64(uint32_t crc, const void * buf, size_t length)
 {
 #if CRC32_IS_X86_64
-    assert(data != nullptr);
-
-    static const ssize_t kStepSize = sizeof(uint64_t);
-    static const uint64_t kMaskOne = 0xFFFFFFFFFFFFFFFFULL;
+    assert(buf != nullptr);
 
-    uint64_t crc64 = crc;
+    static const size_t kStepSize = sizeof(uint64_t);
 
     const char * data = (const char *)buf;
-    const char * data_end = (const char *)buf + length;
-    ssize_t remain = length;
-
-    do {
-        if (likely(remain >= kStepSize)) {
-            assert(data < data_end);
-            uint64_t data64 = *(uint64_t *)(data);
-            crc64 = _mm_crc32_u64(crc64, data64);
-            data += kStepSize;
-            remain -= kStepSize;
-        }
-        else {
-            assert((data_end - data) >= 0 && (data_end - data) < kStepSize);
-            assert((data_end - data) == remain);
-            assert(remain >= 0);
-            if (likely(remain > 0)) {
-                uint64_t data64 = *(uint64_t *)(data);
-                size_t rest = (size_t)(kStepSize - remain);
-                assert(rest > 0 && rest < (size_t)kStepSize);
-                uint64_t mask = kMaskOne >> (rest * 8U);
-                data64 &= mask;
-                crc64 = _mm_crc32_u64(crc64, data64);
-            }
-            break;
-        }
-    } while (1);
+    const char * data_end = data + length;
+    if (length < kStepSize) {
+        return crc32c_hw_short(crc, data, length);
+    }
 
-    return (uint32_t)crc64;
+    uint64_t crc64 = crc;
+    size_t remain = length;
+    while (likely(remain >= kStepSize)) {
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(data));
+        data += kStepSize;
+        remain -= kStepSize;
+    }
+
+    assert(data_end - data == (ptrdiff_t)remain);
+    return crc32c_hw_tail((uint32_t)crc64, data_end, remain);
 #else
     return crc32c_hw_x86(crc, buf, length);
 #endif // CRC32_IS_X86_64
 }
 
+CRC32C_TARGET_HW
 uint32_t crc32c_hw_u32(uint32_t crc, const void * buf, size_t length)
 {
-    assert(data != nullptr);
+    assert(buf != nullptr);
     uint32_t crc32 = crc;
 
     static const size_t kStepSize = sizeof(uint32_t);
     const char * data = (const char *)buf;
-    uint32_t * src = (uint32_t *)data;
-    uint32_t * src_end = src + (length / kStepSize);
+    if (length < sizeof(uint64_t)) {
+        return crc32c_hw_short(crc32, data, length);
+    }
+    const char * src = data;
+    const char * src_end = src + (length & ~(kStepSize - 1));
 
     while (likely(src < src_end)) {
-        crc32 = _mm_crc32_u32(crc32, *src);
-        ++src;
+        crc32 = _mm_crc32_u32(crc32, crc32c_load_u32(src));
+        src += kStepSize;
     }
 
-    unsigned char * src8 = (unsigned char *)src;
-    unsigned char * src8_end = (unsigned char *)(data + length);
-
-    while (likely(src8 < src8_end)) {
-        crc32 = _mm_crc32_u8(crc32, *src8);
-        ++src8;
-    }
-    return crc32;
+    return crc32c_hw_tail(crc32, data + length, length % kStepSize);
 }
 
+CRC32C_TARGET_HW
 uint32_t crc32c_hw_u64(uint32_t crc, const void * buf, size_t length)
 {
 #if CRC32_IS_X86_64
-    assert(data != nullptr);
+    assert(buf != nullptr);
     uint64_t crc64 = crc;
 
     static const size_t kStepSize = sizeof(uint64_t);
     const char * data = (const char *)buf;
-    uint64_t * src = (uint64_t *)data;
-    uint64_t * src_end = src + (length / kStepSize);
+    if (length < kStepSize) {
+        return crc32c_hw_short(crc, data, length);
+    }
+    const char * src = data;
+    const char * src_end = src + (length & ~(kStepSize - 1));
 
     while (likely(src < src_end)) {
-        crc64 = _mm_crc32_u64(crc64, *src);
-        ++src;
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(src));
+        src += kStepSize;
     }
 
-    uint32_t crc32 = (uint32_t)crc64;
-    unsigned char * src8 = (unsigned char *)src;
-    unsigned char * src8_end = (unsigned char *)(data + length);
-
-    while (likely(src8 < src8_end)) {
-        crc32 = _mm_crc32_u8(crc32, *src8);
-        ++src8;
-    }
-    return crc32;
+    return crc32c_hw_tail((uint32_t)crc64, data + length, length % kStepSize);
 #else
     return crc32c_hw_u32(crc, buf, length);
 #endif // CRC32_IS_X86_64
 }
 
+CRC32C_TARGET_HW
 static inline uint64_t crc32c_combine_crc_u32(size_t block_size, uint32_t crc0, uint32_t crc1, uint32_t crc2, const uint64_t * next2) {
     assert(block_size > 0 && block_size <= (sizeof(crc32c_clmul_constants) / 2));
     const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i *>(crc32c_clmul_constants) + block_size - 1);
@@ -347,7 +355,7 @@ static inline uint64_t crc32c_combine_crc_u32(size_t block_size, uint32_t crc0,
     const __m128i crc1_xmm = _mm_cvtsi32_si128((int32_t)crc1);
     const __m128i result1  = _mm_clmulepi64_si128(crc1_xmm, multiplier, 0x10);
     const __m128i result   = _mm_xor_si128(result0, result1);
-    const __m128i __next2  = _mm_loadu_si128(reinterpret_cast<const __m128i *>((uint64_t *)next2 - 2));
+    const __m128i __next2  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(next2 - 2));
     const __m128i result64 = _mm_xor_si128(result, __next2);
     uint32_t crc0_low  = _mm_cvtsi128_si32(result64);
     uint32_t crc32     = _mm_crc32_u32(crc2, crc0_low);
@@ -360,50 +368,101 @@ static inline uint64_t crc32c_combine_crc_u32(size_t block_size, uint32_t crc0,
 
 /*
  * crc32c_combine_crc() performs pclmulqdq multiplication of 2 partial CRC's and a well
- * chosen constant and xor's these with the remaining CRC.
+ * chosen constant and xor's these with the remaining CRC. multipliers[0] moves crc0
+ * over two streams and multipliers[1] moves crc1 over one.
  */
-static inline uint64_t crc32c_combine_crc_u64(size_t block_size, uint64_t crc0, uint64_t crc1, uint64_t crc2, const uint64_t * next2) {
-    assert(block_size > 0 && block_size <= (sizeof(crc32c_clmul_constants) / 2));
-    const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i *>(crc32c_clmul_constants) + block_size - 1);
+CRC32C_TARGET_HW
+static inline uint64_t crc32c_combine_crc_k(const uint64_t * multipliers, uint64_t crc0, uint64_t crc1, uint64_t crc2, const uint64_t * next2) {
+    const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i *>(multipliers));
     const __m128i crc0_xmm = _mm_cvtsi64_si128((int64_t)crc0);
     const __m128i result0  = _mm_clmulepi64_si128(crc0_xmm, multiplier, 0x00);
     const __m128i crc1_xmm = _mm_cvtsi64_si128((int64_t)crc1);
     const __m128i result1  = _mm_clmulepi64_si128(crc1_xmm, multiplier, 0x10);
     const __m128i result   = _mm_xor_si128(result0, result1);
     crc0 = (uint64_t)_mm_cvtsi128_si64(result);
-    crc0 = crc0 ^ *((uint64_t *)next2 - 1);
+    crc0 = crc0 ^ crc32c_load_u64(next2 - 1);
     uint64_t crc32 = _mm_crc32_u64(crc2, crc0);
     return crc32;
 }
 
+CRC32C_TARGET_HW
+static inline uint64_t crc32c_combine_crc_u64(size_t block_size, uint64_t crc0, uint64_t crc1, uint64_t crc2, const uint64_t * next2) {
+    assert(block_size > 0 && block_size <= (sizeof(crc32c_clmul_constants) / 2));
+    return crc32c_combine_crc_k(&crc32c_clmul_constants[2 * (block_size - 1)], crc0, crc1, crc2, next2);
+}
+
 #endif // CRC32C_IS_X86_64
 
+CRC32C_TARGET_HW
 static inline uint32_t __crc32c_hw_u32(const char * data, size_t length, uint32_t crc_init)
 {
     assert(data != nullptr);
     uint32_t crc32 = crc_init;
 
     static const size_t kStepSize = sizeof(uint32_t);
-    uint32_t * src = (uint32_t *)data;
-    uint32_t * src_end = src + (length / kStepSize);
+    if (length < sizeof(uint64_t)) {
+        return crc32c_hw_short(crc32, data, length);
+    }
+    const char * src = data;
+    const char * src_end = src + (length & ~(kStepSize - 1));
 
     while (likely(src < src_end)) {
-        crc32 = _mm_crc32_u32(crc32, *src);
-        ++src;
+        crc32 = _mm_crc32_u32(crc32, crc32c_load_u32(src));
+        src += kStepSize;
     }
 
-    unsigned char * src8 = (unsigned char *)src;
-    unsigned char * src8_end = (unsigned char *)(data + length);
-
-    while (likely(src8 < src8_end)) {
-        crc32 = _mm_crc32_u8(crc32, *src8);
-        ++src8;
-    }
-    return crc32;
+    return crc32c_hw_tail(crc32, data + length, length % kStepSize);
 }
 
 #if CRC32C_IS_X86_64
 
+// The prefetching variant asks for one cache line per stream every this many
+// quadwords, i.e. once per line each stream reads
+static const size_t kPrefetchStride = 64 / sizeof(uint64_t);
+
+/*
+ * crc32c_hw_streams3() runs three streams over loop quadwords each. With kPrefetch
+ * every stream asks for the line prefetch_distance bytes ahead once per line.
+ */
+template <bool kPrefetch>
+CRC32C_TARGET_SSE42
+static inline void crc32c_hw_streams3(uint64_t & crc0, uint64_t & crc1, uint64_t & crc2,
+        uint64_t *& next0, uint64_t *& next1, uint64_t *& next2, size_t loop, size_t prefetch_distance)
+{
+    if (kPrefetch) {
+        while (likely(loop >= kPrefetchStride)) {
+            _mm_prefetch((const char *)next0 + prefetch_distance, _MM_HINT_T0);
+            _mm_prefetch((const char *)next1 + prefetch_distance, _MM_HINT_T0);
+            _mm_prefetch((const char *)next2 + prefetch_distance, _MM_HINT_T0);
+            for (size_t i = 0; i < kPrefetchStride; ++i) {
+                crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+                crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+                crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(next2));
+                ++next0;
+                ++next1;
+                ++next2;
+            }
+            loop -= kPrefetchStride;
+        }
+    }
+    while (likely(loop > 0)) {
+        crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+        crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+        crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(next2));
+        ++next0;
+        ++next1;
+        ++next2;
+        --loop;
+    }
+}
+
+/*
+ * With kPrefetch every stream prefetches the line crc32cTuning().prefetchDistance
+ * bytes ahead of itself. The hardware prefetcher follows one or two streams well,
+ * but three streams a block apart make it fall behind when the data comes from DRAM.
+ */
+template <bool kPrefetch>
+CRC32C_TARGET_HW
 static inline uint32_t __crc32c_hw_u64(const char * data, size_t length, uint32_t crc_init)
 {
     static const size_t kStepSize = sizeof(uint64_t);
@@ -413,31 +472,25 @@ static inline uint32_t __crc32c_hw_u64(const char * data, size_t length, uint32_
     assert(data != nullptr);
     uint32_t crc32 = crc_init;
 
+    // The head and tail below each load a whole quadword inside the buffer
+    if (unlikely(length < kStepSize)) {
+        return crc32c_hw_short(crc32, data, length);
+    }
+
     unsigned char * src8 = (unsigned char *)data;
     size_t data_len = length;
 
     size_t unaligned = ((kAlignment - (size_t)src8) & (kAlignment - 1));
-    if (likely(unaligned != 0)) {
-        length -= unaligned;
-        if (likely(unaligned & 0x04U)) {
-            crc32 = _mm_crc32_u32(crc32, *(uint32_t *)src8);
-            src8 += sizeof(uint32_t);
-        }
-        if (likely(unaligned & 0x02U)) {
-            crc32 = _mm_crc32_u16(crc32, *(uint16_t *)src8);
-            src8 += sizeof(uint16_t);
-        }
-        if (likely(unaligned & 0x01U)) {
-            crc32 = _mm_crc32_u8(crc32, *(uint8_t *)src8);
-            src8 += sizeof(uint8_t);
-        }
-    }
+    crc32 = crc32c_hw_head(crc32, data, unaligned);
+    length -= unaligned;
+    src8 += unaligned;
 
     uint64_t crc64;
     uint64_t * src = (uint64_t *)src8;
 
     if (likely(length >= kLoopSize * 4)) {
-        static const size_t kMaxBlockSize = 128;
+        const size_t max_block_size = crc32cTuning().hwMaxBlock;
+        const size_t prefetch_distance = crc32cTuning().prefetchDistance;
 
         uint64_t crc0 = (uint64_t)crc32;
         uint64_t crc1 = 0;
@@ -448,7 +501,7 @@ static inline uint32_t __crc32c_hw_u64(const char * data, size_t length, uint32_
         length = length % kLoopSize;
         
         while (likely(loops > 0)) {
-            block_size = (likely(loops >= kMaxBlockSize)) ? kMaxBlockSize : loops;
+            block_size = (likely(loops >= max_block_size)) ? max_block_size : loops;
             assert(block_size >= 1);
 
             uint64_t * next0 = src;
@@ -457,35 +510,26 @@ static inline uint32_t __crc32c_hw_u64(const char * data, size_t length, uint32_
 #if 0
             size_t loop = block_size / 2;
             do {
-                crc0 = _mm_crc32_u64(crc0, *next0);
-                crc1 = _mm_crc32_u64(crc1, *next1);
-                crc2 = _mm_crc32_u64(crc2, *next2);
+                crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+                crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+                crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(next2));
                 ++next0;
                 ++next1;
                 ++next2;
                 --loop;
-                crc0 = _mm_crc32_u64(crc0, *next0);
-                crc1 = _mm_crc32_u64(crc1, *next1);
+                crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+                crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
                 if (likely(loop > 0))
-                    crc2 = _mm_crc32_u64(crc2, *next2);
+                    crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(next2));
                 ++next0;
                 ++next1;
                 ++next2;
             } while (likely(loop > 0));
 #else
-            size_t loop = block_size - 1;
-            while (likely(loop > 0)) {
-                crc0 = _mm_crc32_u64(crc0, *next0);
-                crc1 = _mm_crc32_u64(crc1, *next1);
-                crc2 = _mm_crc32_u64(crc2, *next2);
-                ++next0;
-                ++next1;
-                ++next2;
-                --loop;
-            }
+            crc32c_hw_streams3<kPrefetch>(crc0, crc1, crc2, next0, next1, next2, block_size - 1, prefetch_distance);
 
-            crc0 = _mm_crc32_u64(crc0, *next0);
-            crc1 = _mm_crc32_u64(crc1, *next1);
+            crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
             ++next0;
             ++next1;
             ++next2;
@@ -508,50 +552,499 @@ static inline uint32_t __crc32c_hw_u64(const char * data, size_t length, uint32_
     uint64_t * src_end = src + (length / kStepSize);
 
     while (likely(src < src_end)) {
-        crc64 = _mm_crc32_u64(crc64, *src);
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(src));
         ++src;
     }
 
     // Pack the crc64 to 32 bit integer.
     crc32 = (uint32_t)crc64;
 
-    unsigned char * src8_end;
     src8 = (unsigned char *)src;
-    src8_end = (unsigned char *)(data + data_len);
-    assert(src8 <= src8_end);
-
-    size_t remain = (size_t)(src8_end - src8);
-    assert(remain >= 0 && remain < kStepSize);
-    if (likely(remain != 0)) {
-        if (likely(remain & 0x04U)) {
-            crc32 = _mm_crc32_u32(crc32, *(uint32_t *)src8);
-            src8 += sizeof(uint32_t);
-        }
-        if (likely(remain & 0x02U)) {
-            crc32 = _mm_crc32_u16(crc32, *(uint16_t *)src8);
-            src8 += sizeof(uint16_t);
+    const char * data_end = data + data_len;
+    assert((const char *)src8 <= data_end);
+
+    size_t remain = (size_t)(data_end - (const char *)src8);
+    assert(remain < kStepSize);
+    return crc32c_hw_tail(crc32, data_end, remain);
+}
+
+#endif // CRC32C_IS_X86_64
+
+#if CRC32C_IS_X86_64
+
+/*
+ * crc32c_combine_crc_multi() is crc32c_combine_crc_u64() for any number of streams:
+ * every stream but the last is moved over the streams after it with one pclmulqdq
+ * each, and the sum is folded into the last quadword of the last stream.
+ */
+template <size_t kStreams>
+CRC32C_TARGET_HW
+static inline uint64_t crc32c_combine_crc_multi(size_t block_size, const uint64_t * crcs, const uint64_t * next_last) {
+    assert(block_size > 0 && block_size <= kMaxStreamBlockSize);
+    __m128i result = _mm_setzero_si128();
+    for (size_t i = 0; i < kStreams - 1; ++i) {
+        const uint64_t * multiplier = &crc32c_clmul_shift[(kStreams - 1 - i) * block_size - 1];
+        const __m128i crc_xmm = _mm_cvtsi64_si128((int64_t)crcs[i]);
+        const __m128i mul_xmm = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(multiplier));
+        result = _mm_xor_si128(result, _mm_clmulepi64_si128(crc_xmm, mul_xmm, 0x00));
+    }
+    uint64_t crc0 = (uint64_t)_mm_cvtsi128_si64(result);
+    crc0 = crc0 ^ crc32c_load_u64(next_last - 1);
+    return _mm_crc32_u64(crcs[kStreams - 1], crc0);
+}
+
+/*
+ * __crc32c_hw_u64() with kStreams interleaved streams instead of three, for cores
+ * that can keep more crc32 instructions in flight than its latency requires.
+ */
+template <size_t kStreams>
+CRC32C_TARGET_HW
+static inline uint32_t __crc32c_hw_multi(const char * data, size_t length, uint32_t crc_init)
+{
+    static const size_t kStepSize = sizeof(uint64_t);
+    static const size_t kAlignment = sizeof(uint64_t);
+    static const size_t kLoopSize = kStreams * kStepSize;
+
+    assert(data != nullptr);
+    uint32_t crc32 = crc_init;
+
+    unsigned char * src8 = (unsigned char *)data;
+    size_t data_len = length;
+
+    if (unlikely(length < kStepSize)) {
+        return crc32c_hw_short(crc32, data, length);
+    }
+
+    // Only worth aligning when the streams will run
+    size_t unaligned = ((kAlignment - (size_t)src8) & (kAlignment - 1));
+    if (likely(length >= kLoopSize * 4)) {
+        crc32 = crc32c_hw_head(crc32, data, unaligned);
+        length -= unaligned;
+        src8 += unaligned;
+    }
+
+    uint64_t crc64 = (uint64_t)crc32;
+    uint64_t * src = (uint64_t *)src8;
+
+    if (likely(length >= kLoopSize * 4)) {
+        size_t max_block_size = crc32cTuning().hwMaxBlock;
+
+        uint64_t crcs[kStreams];
+        crcs[0] = crc64;
+
+        size_t loops = length / kLoopSize;
+        length = length % kLoopSize;
+
+        while (likely(loops > 0)) {
+            size_t block_size = (likely(loops >= max_block_size)) ? max_block_size : loops;
+            assert(block_size >= 1);
+
+            for (size_t i = 1; i < kStreams; ++i)
+                crcs[i] = 0;
+
+            const uint64_t * next = src;
+            for (size_t j = 0; j < block_size - 1; ++j) {
+                for (size_t i = 0; i < kStreams; ++i)
+                    crcs[i] = _mm_crc32_u64(crcs[i], crc32c_load_u64(next + i * block_size));
+                ++next;
+            }
+            // The last quadword of the last stream is folded in by the combine
+            for (size_t i = 0; i < kStreams - 1; ++i)
+                crcs[i] = _mm_crc32_u64(crcs[i], crc32c_load_u64(next + i * block_size));
+            ++next;
+
+            src = (uint64_t *)next + (kStreams - 1) * block_size;
+            crcs[0] = crc32c_combine_crc_multi<kStreams>(block_size, crcs, src);
+            loops -= block_size;
         }
-        if (likely(remain & 0x01U)) {
-            crc32 = _mm_crc32_u8(crc32, *(uint8_t *)src8);
-            src8 += sizeof(uint32_t);
+
+        crc64 = crcs[0];
+    }
+
+    uint64_t * src_end = src + (length / kStepSize);
+
+    while (likely(src < src_end)) {
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(src));
+        ++src;
+    }
+
+    const char * data_end = data + data_len;
+    assert((const char *)src <= data_end);
+    return crc32c_hw_tail((uint32_t)crc64, data_end, (size_t)(data_end - (const char *)src));
+}
+
+/*
+ * __crc32c_hw_large() runs the three streams of __crc32c_hw_u64<true> over whole
+ * 2 MiB pages, a third of a page each. On a buffer backed by huge pages all three
+ * streams then share one TLB entry, and a page walk happens once per 2 MiB
+ * instead of once per 4 KiB per stream. The part before the first page boundary
+ * and after the last one goes to __crc32c_hw_u64<true>.
+ */
+CRC32C_TARGET_HW
+static inline uint32_t __crc32c_hw_large(const char * data, size_t length, uint32_t crc_init)
+{
+    assert(data != nullptr);
+    const char * data_end = data + length;
+    const char * page = (const char *)(((uintptr_t)data + kLargePageSize - 1) & ~(uintptr_t)(kLargePageSize - 1));
+    if (page > data_end || (size_t)(data_end - page) < kLargePageSize) {
+        return __crc32c_hw_u64<true>(data, length, crc_init);
+    }
+
+    uint32_t crc32 = __crc32c_hw_u64<true>(data, (size_t)(page - data), crc_init);
+    const size_t prefetch_distance = crc32cTuning().prefetchDistance;
+    const char * page_end = page + kLargePageSize;
+    while (likely(page_end <= data_end)) {
+        uint64_t * next0 = (uint64_t *)page;
+        uint64_t * next1 = next0 + kLargeStreamSize;
+        uint64_t * next2 = next1 + kLargeStreamSize;
+        uint64_t crc0 = crc32;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+
+        crc32c_hw_streams3<true>(crc0, crc1, crc2, next0, next1, next2, kLargeStreamSize - 1, prefetch_distance);
+        crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+        crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+        ++next2;
+        uint64_t crc64 = crc32c_combine_crc_k(crc32c_large_shift, crc0, crc1, crc2, next2);
+
+        // A page is not a multiple of three quadwords
+        for (const char * rest = (const char *)next2; rest < page_end; rest += sizeof(uint64_t)) {
+            crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(rest));
         }
+        crc32 = (uint32_t)crc64;
+        page = page_end;
+        page_end += kLargePageSize;
     }
-    assert(src8 == src8_end);
-    return crc32;
+    return __crc32c_hw_u64<true>(page, (size_t)(data_end - page), crc32);
+}
+
+// Below this page size crc32c_pages() calls crc32c_hw per page
+static const size_t kPagesMinSize = sizeof(uint64_t);
+
+/*
+ * __crc32c_pages3() checksums three consecutive pages of the same size at once.
+ * Each page is one crc32q stream, and the three streams keep the crc32 unit as busy
+ * as the triplets of __crc32c_hw_u64, but every page ends on its own crc: there is
+ * nothing to combine. The page size must be at least 8 bytes for crc32c_hw_tail.
+ */
+CRC32C_TARGET_HW
+static inline void __crc32c_pages3(const char * page, size_t page_size, uint32_t * out)
+{
+    assert(page_size >= sizeof(uint64_t));
+    const char * next0 = page;
+    const char * next1 = next0 + page_size;
+    const char * next2 = next1 + page_size;
+    uint64_t crc0 = crc32cInit();
+    uint64_t crc1 = crc32cInit();
+    uint64_t crc2 = crc32cInit();
+
+    for (size_t n = page_size / sizeof(uint64_t); n > 0; --n) {
+        crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+        crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+        crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(next2));
+        next0 += sizeof(uint64_t);
+        next1 += sizeof(uint64_t);
+        next2 += sizeof(uint64_t);
+    }
+
+    const size_t rest = page_size % sizeof(uint64_t);
+    out[0] = crc32cFinish(crc32c_hw_tail((uint32_t)crc0, next0 + rest, rest));
+    out[1] = crc32cFinish(crc32c_hw_tail((uint32_t)crc1, next1 + rest, rest));
+    out[2] = crc32cFinish(crc32c_hw_tail((uint32_t)crc2, next2 + rest, rest));
+}
+
+/*
+ * __crc32c_buffers3() is __crc32c_pages3() for three buffers of any lengths: the
+ * quadwords all three have are hashed as three interleaved streams, and the rest
+ * of each buffer is left to crc32cHardware64. Nothing here folds with pclmulqdq,
+ * so SSE4.2 alone is enough.
+ */
+CRC32C_TARGET_SSE42
+static inline void __crc32c_buffers3(const void * const * data, const size_t * lengths, uint32_t * out)
+{
+    size_t common = lengths[0] < lengths[1] ? lengths[0] : lengths[1];
+    common = (common < lengths[2] ? common : lengths[2]) / sizeof(uint64_t);
+    uint64_t crc0 = crc32cInit();
+    uint64_t crc1 = crc32cInit();
+    uint64_t crc2 = crc32cInit();
+    uint64_t * next0 = (uint64_t *)data[0];
+    uint64_t * next1 = (uint64_t *)data[1];
+    uint64_t * next2 = (uint64_t *)data[2];
+    crc32c_hw_streams3<false>(crc0, crc1, crc2, next0, next1, next2, common, 0);
+
+    const size_t done = common * sizeof(uint64_t);
+    out[0] = crc32cFinish(crc32cHardware64((uint32_t)crc0, next0, lengths[0] - done));
+    out[1] = crc32cFinish(crc32cHardware64((uint32_t)crc1, next1, lengths[1] - done));
+    out[2] = crc32cFinish(crc32cHardware64((uint32_t)crc2, next2, lengths[2] - done));
 }
 
 #endif // CRC32C_IS_X86_64
 
+CRC32C_TARGET_HW
 uint32_t crc32c_hw(uint32_t crc_init, const void * data, size_t length)
 {
 #if CRC32C_IS_X86_64
-    return __crc32c_hw_u64((const char *)data, length, crc_init);
+    return __crc32c_hw_u64<false>((const char *)data, length, crc_init);
+#else
+    return __crc32c_hw_u32((const char *)data, length, crc_init);
+#endif
+}
+
+CRC32C_TARGET_HW
+uint32_t crc32c_hw_prefetch(uint32_t crc_init, const void * data, size_t length)
+{
+#if CRC32C_IS_X86_64
+    return __crc32c_hw_u64<true>((const char *)data, length, crc_init);
+#else
+    return __crc32c_hw_u32((const char *)data, length, crc_init);
+#endif
+}
+
+CRC32C_TARGET_HW
+uint32_t crc32c_hw_large(uint32_t crc_init, const void * data, size_t length)
+{
+#if CRC32C_IS_X86_64
+    return __crc32c_hw_large((const char *)data, length, crc_init);
+#else
+    return __crc32c_hw_u32((const char *)data, length, crc_init);
+#endif
+}
+
+CRC32C_TARGET_HW
+uint32_t crc32c_hw_4way(uint32_t crc_init, const void * data, size_t length)
+{
+#if CRC32C_IS_X86_64
+    return __crc32c_hw_multi<4>((const char *)data, length, crc_init);
+#else
+    return __crc32c_hw_u32((const char *)data, length, crc_init);
+#endif
+}
+
+CRC32C_TARGET_HW
+uint32_t crc32c_hw_6way(uint32_t crc_init, const void * data, size_t length)
+{
+#if CRC32C_IS_X86_64
+    return __crc32c_hw_multi<6>((const char *)data, length, crc_init);
 #else
     return __crc32c_hw_u32((const char *)data, length, crc_init);
 #endif
 }
 
-#endif // __SSE4_2__
+CRC32C_TARGET_HW
+void crc32c_pages(const void * base, size_t page_size, size_t count, uint32_t * out)
+{
+    const char * page = (const char *)base;
+    size_t i = 0;
+#if CRC32C_IS_X86_64
+    // Short pages are better off in one crc32c_hw call each
+    if (page_size >= kPagesMinSize) {
+        for (; i + 3 <= count; i += 3) {
+            __crc32c_pages3(page, page_size, out + i);
+            page += 3 * page_size;
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = crc32cFinish(crc32c_hw(crc32cInit(), page, page_size));
+        page += page_size;
+    }
+}
+
+CRC32C_TARGET_SSE42
+void crc32c_buffers(const void * const * data, const size_t * lengths, size_t count, uint32_t * out)
+{
+    size_t i = 0;
+#if CRC32C_IS_X86_64
+    for (; i + 3 <= count; i += 3) {
+        __crc32c_buffers3(data + i, lengths + i, out + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = crc32cFinish(crc32cHardware64(crc32cInit(), data[i], lengths[i]));
+    }
+}
+
+#if CRC32C_IS_X86_64
+
+// Below this length crc32c_checkpoints() hashes record by record with crc32c_hw,
+// like __crc32c_hw_u64 goes to a single stream
+static const size_t kCheckpointsMinLength = 3 * sizeof(uint64_t) * 4;
+
+/*
+ * crc32c_shift_u64() moves crc over q zero quadwords, q <= kMaxStreamBlockSize,
+ * with one pclmulqdq and the crc32q that reduces it, as in crc32c_combine_crc_k.
+ */
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_shift_u64(uint32_t crc, size_t q)
+{
+    assert(q <= kMaxStreamBlockSize);
+    if (q == 0) {
+        return crc;
+    }
+    const __m128i multiplier = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&crc32c_clmul_shift[q - 1]));
+    const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int32_t)crc), multiplier, 0x00);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product));
+}
+
+// Quadword of its stream that holds the checkpoint at offset
+static inline size_t crc32c_checkpoint_quad(size_t offset, size_t stream_start)
+{
+    return (offset - stream_start) / sizeof(uint64_t);
+}
+
+/*
+ * __crc32c_checkpoints3() is one block of __crc32c_hw_u64: three streams of
+ * block_size quadwords from src, the first one starting at crc. offsets[0..count)
+ * are the checkpoints inside the block, as offsets from data. The streams are
+ * stopped at every quadword that holds one, and the crc of its stream there is
+ * saved in out. Streams 1 and 2 run from zero, so after the block the running crc
+ * at the start of their stream, moved up to the quadword, is xored in. Bytes of the
+ * checkpoint inside the quadword are added with crc32c_hw_head. Returns the crc
+ * after the block.
+ */
+CRC32C_TARGET_HW
+static inline uint32_t __crc32c_checkpoints3(uint32_t crc, const uint64_t * src, size_t block_size,
+        const char * data, const size_t * offsets, size_t count, uint32_t * out)
+{
+    assert(block_size >= 1 && block_size <= kMaxStreamBlockSize);
+    const size_t stream_bytes = block_size * sizeof(uint64_t);
+    const size_t base = (size_t)((const char *)src - data);
+
+    // Checkpoints [first[k], first[k + 1]) are in stream k
+    size_t first[4];
+    first[0] = 0;
+    for (size_t k = 1; k < 3; ++k) {
+        first[k] = first[k - 1];
+        while (first[k] < count && offsets[first[k]] < base + k * stream_bytes) {
+            ++first[k];
+        }
+    }
+    first[3] = count;
+
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    uint64_t * next0 = (uint64_t *)src;
+    uint64_t * next1 = next0 + block_size;
+    uint64_t * next2 = next1 + block_size;
+
+    // The last quadword of stream 2 goes into the combine, as in __crc32c_hw_u64
+    const size_t last = block_size - 1;
+    const size_t start0 = base;
+    const size_t start1 = base + stream_bytes;
+    const size_t start2 = base + 2 * stream_bytes;
+    size_t cursor0 = first[0];
+    size_t cursor1 = first[1];
+    size_t cursor2 = first[2];
+    size_t q = 0;
+    while (true) {
+        size_t stop = last;
+        if (cursor0 < first[1] && crc32c_checkpoint_quad(offsets[cursor0], start0) < stop) {
+            stop = crc32c_checkpoint_quad(offsets[cursor0], start0);
+        }
+        if (cursor1 < first[2] && crc32c_checkpoint_quad(offsets[cursor1], start1) < stop) {
+            stop = crc32c_checkpoint_quad(offsets[cursor1], start1);
+        }
+        if (cursor2 < first[3] && crc32c_checkpoint_quad(offsets[cursor2], start2) < stop) {
+            stop = crc32c_checkpoint_quad(offsets[cursor2], start2);
+        }
+        crc32c_hw_streams3<false>(crc0, crc1, crc2, next0, next1, next2, stop - q, 0);
+        q = stop;
+        while (cursor0 < first[1] && crc32c_checkpoint_quad(offsets[cursor0], start0) == q) {
+            out[cursor0++] = (uint32_t)crc0;
+        }
+        while (cursor1 < first[2] && crc32c_checkpoint_quad(offsets[cursor1], start1) == q) {
+            out[cursor1++] = (uint32_t)crc1;
+        }
+        while (cursor2 < first[3] && crc32c_checkpoint_quad(offsets[cursor2], start2) == q) {
+            out[cursor2++] = (uint32_t)crc2;
+        }
+        if (q == last) {
+            break;
+        }
+    }
+
+    crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(next0));
+    crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(next1));
+    ++next0;
+    ++next1;
+    ++next2;
+
+    uint32_t starts[3];
+    starts[0] = 0;
+    starts[1] = (uint32_t)crc0;
+    starts[2] = first[2] < count ? crc32c_shift_u64(starts[1], block_size) ^ (uint32_t)crc1 : 0;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t offset = offsets[i] - base;
+        const size_t stream = offset / stream_bytes;
+        const size_t quad = (offset % stream_bytes) / sizeof(uint64_t);
+        const size_t rest = offset % sizeof(uint64_t);
+        uint32_t running = out[i] ^ crc32c_shift_u64(starts[stream], quad);
+        if (rest != 0) {
+            running = crc32c_hw_head(running, (const char *)src + offset - rest, rest);
+        }
+        out[i] = running;
+    }
+
+    return (uint32_t)crc32c_combine_crc_u64(block_size, crc0, crc1, crc2, next2);
+}
+
+#endif // CRC32C_IS_X86_64
+
+/*
+ * crc32c_checkpoints_hw() hashes data[pos, end) record by record, saving the
+ * running crc at each offset from offsets[*i] on that is at most end.
+ */
+CRC32C_TARGET_HW
+static uint32_t crc32c_checkpoints_hw(uint32_t crc, const char * data, size_t pos, size_t end,
+        const size_t * offsets, size_t n, size_t * i, uint32_t * out)
+{
+    for (; *i < n && offsets[*i] <= end; ++*i) {
+        crc = crc32c_hw(crc, data + pos, offsets[*i] - pos);
+        pos = offsets[*i];
+        out[*i] = crc;
+    }
+    return crc32c_hw(crc, data + pos, end - pos);
+}
+
+CRC32C_TARGET_HW
+uint32_t crc32c_checkpoints(uint32_t crc, const void * data, size_t length,
+        const size_t * offsets, size_t n, uint32_t * out)
+{
+    const char * src = (const char *)data;
+    size_t pos = 0;
+    size_t i = 0;
+#ifndef NDEBUG
+    for (size_t k = 0; k < n; ++k) {
+        assert(offsets[k] <= length && (k == 0 || offsets[k - 1] <= offsets[k]));
+    }
+#endif
+#if CRC32C_IS_X86_64
+    if (length >= kCheckpointsMinLength) {
+        // Up to the first aligned quadword, then whole blocks of three streams
+        size_t unaligned = (sizeof(uint64_t) - (size_t)src) & (sizeof(uint64_t) - 1);
+        crc = crc32c_checkpoints_hw(crc, src, 0, unaligned, offsets, n, &i, out);
+        pos = unaligned;
+
+        static const size_t kLoopSize = 3 * sizeof(uint64_t);
+        const size_t max_block_size = crc32cTuning().hwMaxBlock;
+        size_t loops = (length - pos) / kLoopSize;
+        while (loops > 0) {
+            const size_t block_size = loops >= max_block_size ? max_block_size : loops;
+            const size_t block_end = pos + kLoopSize * block_size;
+            size_t count = 0;
+            while (i + count < n && offsets[i + count] < block_end) {
+                ++count;
+            }
+            crc = __crc32c_checkpoints3(crc, (const uint64_t *)(src + pos), block_size, src, offsets + i, count, out + i);
+            i += count;
+            pos = block_end;
+            loops -= block_size;
+        }
+    }
+#endif
+    return crc32c_checkpoints_hw(crc, src, pos, length, offsets, n, &i, out);
+}
 
 } // namespace logging
 
@@ -2,10 +2,26 @@
 // All rights reserved. Use of this source code is governed by a
 // BSD-style license that can be found in the LICENSE file.
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <sys/mman.h>
 
 #include "logging/crc32c.h"
+#include "logging/crc32caccumulator.h"
+#include "logging/crc32cdelta.h"
+#include "logging/crc32cfixed.h"
+#include "logging/crc32cgf2.h"
+#include "logging/crc32chuge.h"
+#include "logging/crc32cparallel.h"
+#include "logging/crc32crolling.h"
+#include "logging/crc32cservice.h"
+#include "logging/crc32cstats.h"
+#include "logging/crc32ctuning.h"
 #include "stupidunit/stupidunit.h"
 
 using namespace logging;
@@ -21,7 +37,11 @@ TEST(CRC32C, CPUDetection) {
     /* crc = */ crc32c(crc32cInit(), NULL, 0);
     EXPECT_EQ(final, crc32c);
 
-    EXPECT_EQ(final, detectBestCRC32C());
+    // With CRC32C_STATS=1 in the environment crc32c is the counting wrapper
+    if (!crc32cStatsEnabled()) {
+        EXPECT_EQ(final, detectBestCRC32C());
+    }
+    EXPECT_EQ(detectBestCRC32C(), crc32cStatsSnapshot().kernel);
 }
 
 struct CRC32CFunctionInfo {
@@ -34,24 +54,49 @@ static const CRC32CFunctionInfo FNINFO[] = {
     MAKE_FN_STRUCT(crc32cSarwate),
     MAKE_FN_STRUCT(crc32cSlicingBy4),
     MAKE_FN_STRUCT(crc32cSlicingBy8),
+    MAKE_FN_STRUCT(crc32cBraided),
+    // Only need SSE4.2; keep crc32cAdler last of them
     MAKE_FN_STRUCT(crc32cHardware32),
 #ifdef __LP64__
     MAKE_FN_STRUCT(crc32cHardware64),
-    MAKE_FN_STRUCT(crc32cIntelAsm),
 #endif
     MAKE_FN_STRUCT(crc32cAdler),
+    // Need SSE4.2 and PCLMULQDQ
+#ifdef __LP64__
+    MAKE_FN_STRUCT(crc32cIntelAsm),
+#endif
     MAKE_FN_STRUCT(crc32cIntelC),
+    MAKE_FN_STRUCT(crc32c_hw_x86),
+    MAKE_FN_STRUCT(crc32c_hw_x64),
+    MAKE_FN_STRUCT(crc32c_hw_u32),
+    MAKE_FN_STRUCT(crc32c_hw_u64),
+    MAKE_FN_STRUCT(crc32c_hw),
+    MAKE_FN_STRUCT(crc32c_hw_4way),
+    MAKE_FN_STRUCT(crc32c_hw_6way),
+    MAKE_FN_STRUCT(crc32c_hw_prefetch),
+    MAKE_FN_STRUCT(crc32c_hw_large),
+    // Needs AVX2 and VPCLMULQDQ; keep it last so it can be trimmed on its own
+    MAKE_FN_STRUCT(crc32c_vpclmul_avx2),
 };
 #undef MAKE_FN_STRUCT
 
 static size_t numValidFunctions() {
     size_t numFunctions = sizeof(FNINFO)/sizeof(*FNINFO);
-    bool hasHardware = (detectBestCRC32C() != crc32cSlicingBy8);
-    if (!hasHardware) {
-        while (FNINFO[numFunctions-1].crcfn == crc32cHardware32 ||
-                FNINFO[numFunctions-1].crcfn == crc32cHardware64 ||
-                FNINFO[numFunctions-1].crcfn == crc32cIntelC) {
-            numFunctions -= 1;
+    if (!crc32cHasVPCLMULQDQ()) {
+        numFunctions -= 1;
+    }
+    // The software kernels come first and end with crc32cBraided, then the ones
+    // that only need SSE4.2 end with crc32cAdler; everything after that needs
+    // PCLMULQDQ as well
+    CRC32CFunctionPtr last = NULL;
+    if (detectBestCRC32C() == crc32cBraided) {
+        last = crc32cBraided;
+    } else if (!crc32cHasPCLMULQDQ()) {
+        last = crc32cAdler;
+    }
+    if (last != NULL) {
+        numFunctions = 0;
+        while (FNINFO[numFunctions++].crcfn != last) {
         }
     }
     return numFunctions;
@@ -181,6 +226,666 @@ TEST(CRC32C, Alignment) {
     }
 }
 
+TEST(CRC32C, ShortPieces) {
+    // Feed a buffer in pieces of every length up to 15 bytes, at every offset, so the
+    // tails are folded into crcs other than the initial value
+    static const size_t SIZE = 512;
+    char buffer[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 131 + 7);
+    }
+    for (size_t piece = 1; piece < 16; ++piece) {
+        for (size_t offset = 0; offset < 8; ++offset) {
+            size_t length = SIZE - offset;
+            uint32_t expected = crc32cSarwate(crc32cInit(), buffer + offset, length);
+            for (int j = 0; j < NUM_VALID_FUNCTIONS; ++j) {
+                uint32_t crc = crc32cInit();
+                for (size_t done = 0; done < length; done += piece) {
+                    size_t n = (length - done < piece) ? length - done : piece;
+                    crc = FNINFO[j].crcfn(crc, buffer + offset + done, n);
+                }
+                if (crc != expected) {
+                    printf("Failed %s piece = %zu offset = %zu\n", FNINFO[j].name, piece, offset);
+                }
+                EXPECT_EQ(expected, crc);
+            }
+        }
+    }
+}
+
+TEST(CRC32C, BufferEnd) {
+    static const size_t MAX_LENGTH = 64;
+    char pattern[MAX_LENGTH];
+    for (size_t i = 0; i < MAX_LENGTH; ++i) {
+        pattern[i] = (char)(i * 29 + 3);
+    }
+    // Each buffer is its own heap allocation, so that a kernel loading past the end
+    // is caught by the sanitize build (or faults when the end is on a page boundary).
+    // Length 0 is passed the end of a one-byte buffer, so any read at all is out of
+    // bounds. The others are copied from pattern: GCC warns about a vectorized fill
+    // loop writing into new char[0].
+    char* one = new char[1];
+    for (int j = 0; j < NUM_VALID_FUNCTIONS; ++j) {
+        EXPECT_EQ(crc32cInit(), FNINFO[j].crcfn(crc32cInit(), one + 1, 0));
+    }
+    delete[] one;
+    for (size_t length = 1; length < MAX_LENGTH; ++length) {
+        char* buffer = new char[length];
+        memcpy(buffer, pattern, length);
+        uint32_t expected = crc32cSarwate(crc32cInit(), buffer, length);
+        for (int j = 0; j < NUM_VALID_FUNCTIONS; ++j) {
+            uint32_t crc = FNINFO[j].crcfn(crc32cInit(), buffer, length);
+            if (crc != expected) {
+                printf("Failed %s length = %zu\n", FNINFO[j].name, length);
+            }
+            EXPECT_EQ(expected, crc);
+        }
+        delete[] buffer;
+    }
+}
+
+TEST(CRC32C, Combine) {
+    static const char PHRASE[] = "The quick brown fox jumps over the lazy dog";
+    static const size_t LENGTH = sizeof(PHRASE) - 1;
+    for (size_t split = 0; split <= LENGTH; ++split) {
+        uint32_t crc1 = crc32cFinish(crc32cSarwate(crc32cInit(), PHRASE, split));
+        uint32_t crc2 = crc32cFinish(crc32cSarwate(crc32cInit(), PHRASE + split, LENGTH - split));
+        EXPECT_EQ(0x22620404, crc32cCombine(crc1, crc2, LENGTH - split));
+        EXPECT_EQ(crc1, crc32c_truncate(0x22620404, LENGTH, PHRASE + split, LENGTH - split));
+    }
+
+    // x times its inverse is one, and a long tail drops out like a short one
+    EXPECT_EQ((uint32_t) 1 << 31, crc32c_multiply(crc32c_x_pow(1), crc32c_x_pow_inverse(1)));
+    EXPECT_EQ((uint32_t) 1 << 31, crc32c_multiply(crc32c_x_pow(123457), crc32c_x_pow_inverse(123457)));
+    static const size_t SIZE = 1000000;
+    char* buffer = new char[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 7 + (i >> 9));
+    }
+    uint32_t crc_full = crc32cFinish(crc32c(crc32cInit(), buffer, SIZE));
+    static const size_t PREFIXES[] = { 0, 1, 4093, SIZE - 100000, SIZE };
+    for (size_t i = 0; i < sizeof(PREFIXES)/sizeof(*PREFIXES); ++i) {
+        EXPECT_EQ(crc32cFinish(crc32c(crc32cInit(), buffer, PREFIXES[i])),
+                  crc32c_truncate(crc_full, SIZE, buffer + PREFIXES[i], SIZE - PREFIXES[i]));
+    }
+    delete[] buffer;
+}
+
+// CRC32C_TARGET_HW, so crc32c_fixed is inlined here as it would be in a caller
+template <size_t N>
+CRC32C_TARGET_HW
+static bool checkFixed(const char* data) {
+    // Odd start, so the loads are unaligned
+    uint32_t expected = crc32cSarwate(crc32cInit(), data + 1, N);
+    uint32_t crc = crc32c_fixed<N>(crc32cInit(), data + 1);
+    if (crc != expected) {
+        printf("Failed crc32c_fixed<%zu>\n", N);
+    }
+    return crc == expected;
+}
+
+TEST(CRC32C, Fixed) {
+    if (!crc32cHasPCLMULQDQ()) {
+        return;
+    }
+    static const size_t SIZE = 3 * 8 * 128 * 2 + 64;
+    char* buffer = new char[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 37 + 11);
+    }
+    // The tail bytes, words only, the smallest and largest triplet blocks, and
+    // lengths that take more than one block
+    EXPECT_TRUE(checkFixed<0>(buffer));
+    EXPECT_TRUE(checkFixed<1>(buffer));
+    EXPECT_TRUE(checkFixed<7>(buffer));
+    EXPECT_TRUE(checkFixed<8>(buffer));
+    EXPECT_TRUE(checkFixed<32>(buffer));
+    EXPECT_TRUE(checkFixed<191>(buffer));
+    EXPECT_TRUE(checkFixed<192>(buffer));
+    EXPECT_TRUE(checkFixed<200>(buffer));
+    EXPECT_TRUE(checkFixed<512>(buffer));
+    EXPECT_TRUE(checkFixed<3 * 8 * 128>(buffer));
+    EXPECT_TRUE(checkFixed<4096>(buffer));
+    EXPECT_TRUE(checkFixed<SIZE - 1>(buffer));
+    delete[] buffer;
+}
+
+TEST(CRC32C, Pages) {
+    if (!crc32cHasPCLMULQDQ()) {
+        return;
+    }
+    // Page sizes below, at and above the 8 bytes of a crc32q, odd ones, and counts
+    // that do and do not fill the last group of three
+    static const size_t PAGE_SIZES[] = { 0, 1, 7, 8, 13, 64, 512, 4096 + 5 };
+    static const size_t MAX_COUNT = 8;
+    char* buffer = new char[MAX_COUNT * (4096 + 5) + 1];
+    for (size_t i = 0; i < MAX_COUNT * (4096 + 5) + 1; ++i) {
+        buffer[i] = (char)(i * 53 + 17);
+    }
+    uint32_t out[MAX_COUNT + 1];
+    for (size_t j = 0; j < sizeof(PAGE_SIZES)/sizeof(*PAGE_SIZES); ++j) {
+        const size_t page_size = PAGE_SIZES[j];
+        for (size_t count = 0; count <= MAX_COUNT; ++count) {
+            out[count] = 0x12345678;
+            crc32c_pages(buffer + 1, page_size, count, out);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t expected = crc32cFinish(crc32cSarwate(crc32cInit(), buffer + 1 + i * page_size, page_size));
+                if (out[i] != expected) {
+                    printf("Failed crc32c_pages page_size = %zu count = %zu page %zu\n", page_size, count, i);
+                }
+                EXPECT_EQ(expected, out[i]);
+            }
+            EXPECT_EQ(0x12345678, out[count]);
+        }
+    }
+
+    // crc32c_buffers with lengths that differ within each group of three
+    static const size_t BUFFERS = 8;
+    const void* data[BUFFERS];
+    size_t lengths[BUFFERS];
+    for (size_t i = 0; i < BUFFERS; ++i) {
+        data[i] = buffer + 1 + i * 1000;
+        lengths[i] = (i * 331) % 900;
+    }
+    crc32c_buffers(data, lengths, BUFFERS, out);
+    for (size_t i = 0; i < BUFFERS; ++i) {
+        EXPECT_EQ(crc32cFinish(crc32cSarwate(crc32cInit(), data[i], lengths[i])), out[i]);
+    }
+    delete[] buffer;
+}
+
+TEST(CRC32C, Checkpoints) {
+    if (!crc32cHasPCLMULQDQ()) {
+        return;
+    }
+    static const size_t SIZE = 100000;
+    char* buffer = new char[SIZE + 1];
+    for (size_t i = 0; i < SIZE + 1; ++i) {
+        buffer[i] = (char)(i * 53 + 17 + (i >> 10));
+    }
+    std::vector<uint32_t> running(SIZE + 1);
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> out;
+    uint32_t seed = 1;
+    for (size_t misalign = 0; misalign < 2; ++misalign) {
+        const char* data = buffer + misalign;
+        running[0] = crc32cInit();
+        for (size_t i = 0; i < SIZE; ++i) {
+            running[i + 1] = crc32cSarwate(running[i], data + i, 1);
+        }
+        // Records of a few bytes, of a few quadwords and longer than a block of three
+        // streams, duplicate offsets, and offsets at 0 and at the end
+        static const size_t LENGTHS[] = { 0, 5, 95, 96, 1000, SIZE };
+        static const size_t GAPS[] = { 1, 9, 64, 700, 5000 };
+        for (size_t l = 0; l < sizeof(LENGTHS)/sizeof(*LENGTHS); ++l) {
+            const size_t length = LENGTHS[l];
+            for (size_t g = 0; g < sizeof(GAPS)/sizeof(*GAPS); ++g) {
+                offsets.clear();
+                offsets.push_back(0);
+                size_t offset = 0;
+                while (true) {
+                    seed = seed * 1103515245 + 12345;
+                    offset += (seed >> 16) % (2 * GAPS[g]);
+                    if (offset > length) {
+                        break;
+                    }
+                    offsets.push_back(offset);
+                }
+                offsets.push_back(length);
+                out.assign(offsets.size() + 1, 0x12345678);
+                EXPECT_EQ(running[length], crc32c_checkpoints(crc32cInit(), data, length, &offsets[0], offsets.size(), &out[0]));
+                for (size_t i = 0; i < offsets.size(); ++i) {
+                    if (out[i] != running[offsets[i]]) {
+                        printf("Failed crc32c_checkpoints length = %zu gap = %zu offset %zu\n", length, GAPS[g], offsets[i]);
+                    }
+                    EXPECT_EQ(running[offsets[i]], out[i]);
+                }
+                EXPECT_EQ(0x12345678, out[offsets.size()]);
+            }
+        }
+    }
+    delete[] buffer;
+}
+
+TEST(CRC32C, Rolling) {
+    static const size_t SIZE = 64 * 1024 + 13;
+    char* buffer = new char[SIZE];
+    uint32_t seed = 1;
+    for (size_t i = 0; i < SIZE; ++i) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = (char)(seed >> 16);
+    }
+    static const size_t WINDOWS[] = { 1, 7, 48, 4096 };
+    for (size_t w = 0; w < sizeof(WINDOWS)/sizeof(*WINDOWS); ++w) {
+        const size_t window = WINDOWS[w];
+        RollingCRC32C rolling(window);
+        EXPECT_EQ(window, rolling.window());
+
+        // Every window of the first few KiB against a CRC from scratch, and every
+        // match of a 1 in 256 mask collected the slow way
+        const size_t checked = window + 3000;
+        rolling.start(buffer);
+        std::vector<size_t> expected;
+        for (size_t end = window; end <= SIZE; ++end) {
+            if (end > window) {
+                rolling.roll((uint8_t) buffer[end - 1 - window], (uint8_t) buffer[end - 1]);
+            }
+            if (end <= checked) {
+                EXPECT_EQ(crc32cFinish(crc32cSarwate(crc32cInit(), buffer + end - window, window)), rolling.value());
+            }
+            if ((rolling.value() & 0xFF) == 0) {
+                expected.push_back(end);
+            }
+        }
+
+        // Long enough for the lanes, short enough for the byte loop alone, and
+        // shorter than the window
+        static const size_t LENGTHS[] = { SIZE, 1000, 0 };
+        for (size_t i = 0; i < sizeof(LENGTHS)/sizeof(*LENGTHS); ++i) {
+            std::vector<size_t> ends;
+            rolling.scan(buffer, LENGTHS[i], 0xFF, &ends);
+            size_t count = 0;
+            while (count < expected.size() && expected[count] <= LENGTHS[i]) {
+                ++count;
+            }
+            EXPECT_EQ(count, ends.size());
+            for (size_t j = 0; j < ends.size() && j < count; ++j) {
+                EXPECT_EQ(expected[j], ends[j]);
+            }
+        }
+    }
+    delete[] buffer;
+}
+
+TEST(CRC32C, Delta) {
+    static const size_t SIZE = 256 * 1024 + 100;
+    static const size_t BLOCK = 512;
+    std::vector<char> reference(SIZE);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < SIZE; ++i) {
+        seed = seed * 1103515245 + 12345;
+        reference[i] = (char)(seed >> 16);
+    }
+
+    // A changed byte, bytes inserted and bytes removed, each in the middle of a
+    // block, a stretch copied from further on, and a new tail
+    std::vector<char> changed(reference.begin(), reference.begin() + 10000);
+    changed[5000] ^= 1;
+    changed.insert(changed.end(), 77, 'x');
+    changed.insert(changed.end(), reference.begin() + 10000, reference.begin() + 100000);
+    changed.insert(changed.end(), reference.begin() + 100300, reference.begin() + 200000);
+    changed.insert(changed.end(), reference.begin() + 30000, reference.begin() + 40000);
+    changed.insert(changed.end(), reference.begin() + 200000, reference.end());
+    changed.insert(changed.end(), 300, 'y');
+
+    CRC32CDeltaIndex index(&reference[0], SIZE, BLOCK);
+    EXPECT_EQ(BLOCK, index.blockSize());
+    CRC32CDelta delta;
+    index.diff(&changed[0], changed.size(), &delta);
+    std::vector<char> rebuilt;
+    crc32cDeltaApply(&reference[0], delta, &rebuilt);
+    EXPECT_TRUE(rebuilt == changed);
+    // Each change costs less than two blocks of literals; the reference's tail is
+    // shorter than a block so it is a literal too
+    EXPECT_LT(delta.literals.size(), 5 * 2 * BLOCK + 300 + SIZE % BLOCK);
+    for (size_t i = 1; i < delta.ops.size(); ++i) {
+        EXPECT_FALSE(delta.ops[i].kind == CRC32CDeltaOp::LITERAL &&
+                     delta.ops[i - 1].kind == CRC32CDeltaOp::LITERAL);
+    }
+
+    // The same data is a single copy and its tail
+    index.diff(&reference[0], SIZE, &delta);
+    EXPECT_EQ(2, delta.ops.size());
+    EXPECT_EQ(SIZE % BLOCK, delta.literals.size());
+
+    // Shorter than a block, empty, and against an empty reference
+    index.diff(&changed[0], BLOCK - 1, &delta);
+    EXPECT_EQ(1, delta.ops.size());
+    index.diff(&changed[0], 0, &delta);
+    EXPECT_EQ(0, delta.ops.size());
+    CRC32CDeltaIndex empty(&reference[0], 0, BLOCK);
+    empty.diff(&changed[0], changed.size(), &delta);
+    crc32cDeltaApply(&reference[0], delta, &rebuilt);
+    EXPECT_TRUE(rebuilt == changed);
+
+    // A reference of repeated blocks, like a sparse file: 64K zero blocks index
+    // as one, and data made of them still becomes one copy per run
+    std::vector<char> zeros(64 * 1024 * BLOCK);
+    CRC32CDeltaIndex sparse(&zeros[0], zeros.size(), BLOCK);
+    std::vector<char> mixed(zeros.begin(), zeros.begin() + 10 * BLOCK);
+    mixed.insert(mixed.end(), reference.begin(), reference.begin() + 3 * BLOCK);
+    mixed.insert(mixed.end(), zeros.begin(), zeros.begin() + 5 * BLOCK);
+    sparse.diff(&mixed[0], mixed.size(), &delta);
+    crc32cDeltaApply(&zeros[0], delta, &rebuilt);
+    EXPECT_TRUE(rebuilt == mixed);
+    EXPECT_EQ(3 * BLOCK, delta.literals.size());
+}
+
+TEST(CRC32C, Accumulator) {
+    static const size_t SIZE = 3 * 1024 * 1024 + 17;
+    char* buffer = new char[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 31 + (i >> 12));
+    }
+    const uint32_t expected = crc32cFinish(crc32c(crc32cInit(), buffer, SIZE));
+
+    // Segments of random length, some empty, handed out in a random order to
+    // threads that each add their share
+    std::vector<std::pair<size_t, size_t> > segments;
+    uint32_t seed = 1;
+    for (size_t offset = 0; offset < SIZE; ) {
+        seed = seed * 1103515245 + 12345;
+        size_t length = std::min((size_t)(seed >> 8) % 100000, SIZE - offset);
+        segments.push_back(std::make_pair(offset, length));
+        offset += length;
+    }
+    for (size_t i = segments.size() - 1; i > 0; --i) {
+        seed = seed * 1103515245 + 12345;
+        std::swap(segments[i], segments[(seed >> 8) % (i + 1)]);
+    }
+    static const size_t THREADS = 4;
+    CRC32CAccumulator accumulator(SIZE);
+    EXPECT_EQ(SIZE, accumulator.length());
+    std::atomic<int> completions(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < THREADS; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (size_t i = t; i < segments.size(); i += THREADS) {
+                const char* segment = buffer + segments[i].first;
+                uint32_t crc = crc32cFinish(crc32c(crc32cInit(), segment, segments[i].second));
+                if (accumulator.add(segments[i].first, segments[i].second, crc)) {
+                    ++completions;
+                }
+            }
+        }));
+    }
+    for (size_t t = 0; t < THREADS; ++t) {
+        threads[t].join();
+    }
+    EXPECT_EQ(1, completions.load());
+    EXPECT_TRUE(accumulator.complete());
+    EXPECT_FALSE(accumulator.failed());
+    EXPECT_EQ(expected, accumulator.value());
+
+    // A retried part after the object is complete, and a segment past its end,
+    // are rejected and leave the value alone
+    EXPECT_FALSE(accumulator.add(0, 100, crc32cFinish(crc32c(crc32cInit(), buffer, 100))));
+    EXPECT_TRUE(accumulator.failed());
+    EXPECT_EQ(expected, accumulator.value());
+    CRC32CAccumulator shorter(100);
+    EXPECT_FALSE(shorter.add(50, 51, 0));
+    EXPECT_TRUE(shorter.failed());
+    EXPECT_FALSE(shorter.complete());
+
+    CRC32CAccumulator empty(0);
+    EXPECT_TRUE(empty.complete());
+    EXPECT_EQ(0, empty.value());
+    delete[] buffer;
+}
+
+TEST(CRC32C, HugeBuffer) {
+#ifdef __LP64__
+    // One call over more than 4 GiB, so that a length or a count kept in 32 bits
+    // anywhere shows up. Only the pages written below get memory; the rest of the
+    // mapping reads as zeros.
+    static const size_t LENGTH = ((size_t)1 << 32) + 4099;
+    char* buffer = (char*) mmap(NULL, LENGTH, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buffer == MAP_FAILED) {
+        printf("HugeBuffer: cannot map %zu bytes, skipped\n", LENGTH);
+        return;
+    }
+    static const size_t MARKS[] = {
+        0, 4095, ((size_t)1 << 31) - 3, (size_t)1 << 31, ((size_t)1 << 32) - 1,
+        (size_t)1 << 32, LENGTH - 1,
+    };
+    for (size_t i = 0; i < sizeof(MARKS)/sizeof(*MARKS); ++i) {
+        buffer[MARKS[i]] = (char)(MARKS[i] * 37 + 11) | 1;
+    }
+
+    // The reference joins pieces of 1 GiB, which no kernel can get wrong by
+    // truncating the length, with crc32cCombine
+    static const size_t PIECE = (size_t)1 << 30;
+    uint32_t expected = crc32cFinish(crc32cInit());
+    for (size_t done = 0; done < LENGTH; done += PIECE) {
+        size_t n = (LENGTH - done < PIECE) ? LENGTH - done : PIECE;
+        uint32_t crc = crc32cFinish(crc32c(crc32cInit(), buffer + done, n));
+        expected = (done == 0) ? crc : crc32cCombine(expected, crc, n);
+    }
+
+    // 4 GiB through every kernel takes minutes, nearly all of it in the table
+    // kernels. By default only the dispatched kernel and the ones that keep their
+    // own length and block counters run: crc32c_hw, crc32cIntelC, crc32cAdler and
+    // crc32cIntelAsm. CRC32C_TEST_HUGE_ALL=1 adds the table kernels.
+    static const CRC32CFunctionPtr DEFAULT_KERNELS[] = {
+        crc32c_hw, crc32cIntelC, crc32cAdler, crc32cIntelAsm,
+    };
+    const char* all = getenv("CRC32C_TEST_HUGE_ALL");
+    bool allKernels = all != NULL && strcmp(all, "0") != 0;
+    const CRC32CFunctionPtr dispatched = detectBestCRC32C();
+    for (int j = 0; j < NUM_VALID_FUNCTIONS; ++j) {
+        bool run = allKernels || FNINFO[j].crcfn == dispatched;
+        for (size_t k = 0; !run && k < sizeof(DEFAULT_KERNELS)/sizeof(*DEFAULT_KERNELS); ++k) {
+            run = FNINFO[j].crcfn == DEFAULT_KERNELS[k];
+        }
+        if (!run) {
+            continue;
+        }
+        uint32_t crc = crc32cFinish(FNINFO[j].crcfn(crc32cInit(), buffer, LENGTH));
+        if (crc != expected) {
+            printf("Failed %s length = %zu\n", FNINFO[j].name, LENGTH);
+        }
+        EXPECT_EQ(expected, crc);
+    }
+    munmap(buffer, LENGTH);
+#endif
+}
+
+TEST(CRC32C, HugePages) {
+    // Three huge pages and a bit, so crc32c_hw_large runs whole pages from
+    // unaligned starts and ends
+    static const size_t SIZE = 3 * kCRC32CHugePageSize + 4099;
+    char* buffer = (char*) crc32cAllocHuge(SIZE);
+    EXPECT_TRUE(buffer != NULL);
+    if (buffer == NULL) {
+        return;
+    }
+    EXPECT_EQ(0, (uintptr_t) buffer % kCRC32CHugePageSize);
+    if (!crc32cHasPCLMULQDQ()) {
+        crc32cFreeHuge(buffer, SIZE);
+        return;
+    }
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 131 + (i >> 12));
+    }
+    static const size_t STARTS[] = { 0, 3, kCRC32CHugePageSize - 5 };
+    static const size_t LENGTHS[] = { 2 * kCRC32CHugePageSize, 2 * kCRC32CHugePageSize + 13, 3 * kCRC32CHugePageSize };
+    for (size_t i = 0; i < sizeof(STARTS)/sizeof(*STARTS); ++i) {
+        for (size_t j = 0; j < sizeof(LENGTHS)/sizeof(*LENGTHS); ++j) {
+            const char* data = buffer + STARTS[i];
+            size_t length = LENGTHS[j];
+            if (STARTS[i] + length > SIZE) {
+                continue;
+            }
+            EXPECT_EQ(crc32cSlicingBy8(crc32cInit(), data, length), crc32c_hw_large(crc32cInit(), data, length));
+        }
+    }
+    crc32cFreeHuge(buffer, SIZE);
+}
+
+TEST(CRC32C, Parallel) {
+    // Large enough for several chunks per thread, with unaligned ends
+    static const size_t SIZE = 40 * 1024 * 1024 + 4099;
+    char* buffer = new char[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 29 + (i >> 20));
+    }
+    static const size_t STARTS[] = { 0, 5 };
+    static const size_t LENGTHS[] = { 0, 1000, 5 * 1024 * 1024 + 1, SIZE - 5 };
+    static const size_t THREADS[] = { 0, 1, 2, 3, 8 };
+    for (size_t i = 0; i < sizeof(STARTS)/sizeof(*STARTS); ++i) {
+        for (size_t j = 0; j < sizeof(LENGTHS)/sizeof(*LENGTHS); ++j) {
+            const char* data = buffer + STARTS[i];
+            // Continue from a crc other than the initial value
+            uint32_t crc = crc32c(crc32cInit(), "123", 3);
+            uint32_t expected = crc32c(crc, data, LENGTHS[j]);
+            for (size_t k = 0; k < sizeof(THREADS)/sizeof(*THREADS); ++k) {
+                uint32_t actual = crc32cParallel(crc, data, LENGTHS[j], THREADS[k]);
+                if (actual != expected) {
+                    printf("Failed length = %zu threads = %zu\n", LENGTHS[j], THREADS[k]);
+                }
+                EXPECT_EQ(expected, actual);
+            }
+        }
+    }
+    delete[] buffer;
+}
+
+struct ServiceResult {
+    std::atomic<uint32_t> crc;
+    std::atomic<int> calls;
+};
+
+static void serviceCallback(void* context, uint32_t crc) {
+    ServiceResult* result = (ServiceResult*) context;
+    result->crc.store(crc);
+    ++result->calls;
+}
+
+TEST(CRC32C, Service) {
+    static const size_t SIZE = 1024 * 1024;
+    char* buffer = new char[SIZE];
+    for (size_t i = 0; i < SIZE; ++i) {
+        buffer[i] = (char)(i * 37 + (i >> 11));
+    }
+    // Mostly short buffers, some of them empty, with a long one now and then
+    static const size_t PRODUCERS = 3;
+    static const size_t ITEMS = 2000;
+    std::vector<size_t> offsets(PRODUCERS * ITEMS);
+    std::vector<size_t> lengths(PRODUCERS * ITEMS);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        lengths[i] = (i % 50 == 0) ? (seed >> 8) % (SIZE / 2) : (seed >> 8) % 300;
+        offsets[i] = (seed >> 4) % (SIZE - lengths[i]);
+    }
+    std::vector<ServiceResult> results(offsets.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        results[i].crc.store(0);
+        results[i].calls.store(0);
+    }
+    {
+        // Two workers for the three rings, and a small ring so producers find it full
+        CRC32CService service(PRODUCERS, std::vector<int>(2, -1), 16);
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < PRODUCERS; ++p) {
+            producers.push_back(std::thread([&, p]() {
+                for (size_t i = p * ITEMS; i < (p + 1) * ITEMS; ++i) {
+                    while (!service.submit(p, buffer + offsets[i], lengths[i], serviceCallback, &results[i])) {
+                        std::this_thread::yield();
+                    }
+                }
+            }));
+        }
+        for (size_t p = 0; p < PRODUCERS; ++p) {
+            producers[p].join();
+        }
+    }
+    for (size_t i = 0; i < results.size(); ++i) {
+        uint32_t expected = crc32cFinish(crc32c(crc32cInit(), buffer + offsets[i], lengths[i]));
+        if (results[i].calls.load() != 1 || results[i].crc.load() != expected) {
+            printf("Failed CRC32CService item %zu length = %zu\n", i, lengths[i]);
+        }
+        EXPECT_EQ(1, results[i].calls.load());
+        EXPECT_EQ(expected, results[i].crc.load());
+    }
+
+    // A worker that has gone to sleep wakes up for the next item
+    {
+        CRC32CService service(1, std::vector<int>(1, -1));
+        for (int round = 0; round < 3; ++round) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            ServiceResult result;
+            result.crc.store(0);
+            result.calls.store(0);
+            EXPECT_TRUE(service.submit(0, buffer, 100, serviceCallback, &result));
+            for (int wait = 0; wait < 1000 && result.calls.load() == 0; ++wait) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            EXPECT_EQ(1, result.calls.load());
+            EXPECT_EQ(crc32cFinish(crc32c(crc32cInit(), buffer, 100)), result.crc.load());
+        }
+    }
+    delete[] buffer;
+}
+
+TEST(CRC32C, Stats) {
+    char buffer[300];
+    for (size_t i = 0; i < sizeof(buffer); ++i) {
+        buffer[i] = (char)(i * 7 + 1);
+    }
+    crc32cStatsEnable(true);
+    EXPECT_TRUE(crc32cStatsEnabled());
+    CRC32CStats before = crc32cStatsSnapshot();
+
+    // Lengths in buckets 0, 1, 8 and 9, and one call from a thread that exits
+    // before the snapshot
+    static const size_t LENGTHS[] = { 0, 1, 216, 300 };
+    for (size_t i = 0; i < sizeof(LENGTHS)/sizeof(*LENGTHS); ++i) {
+        EXPECT_EQ(crc32cSarwate(crc32cInit(), buffer, LENGTHS[i]), crc32c(crc32cInit(), buffer, LENGTHS[i]));
+    }
+    std::thread other([&buffer]() { crc32c(crc32cInit(), buffer, 100); });
+    other.join();
+
+    CRC32CStats after = crc32cStatsSnapshot();
+    EXPECT_EQ(5, after.calls - before.calls);
+    EXPECT_EQ(617, after.bytes - before.bytes);
+    static const size_t BUCKETS[] = { 0, 1, 7, 8, 9 };
+    for (size_t i = 0; i < sizeof(BUCKETS)/sizeof(*BUCKETS); ++i) {
+        EXPECT_EQ(1, after.lengths[BUCKETS[i]] - before.lengths[BUCKETS[i]]);
+    }
+    EXPECT_TRUE(after.kernel == detectBestCRC32C());
+    EXPECT_TRUE(strcmp(after.kernelName, "unknown") != 0);
+
+    // Off again, logging::crc32c is the bare kernel and nothing is counted
+    crc32cStatsEnable(false);
+    EXPECT_FALSE(crc32cStatsEnabled());
+    EXPECT_TRUE(crc32c == detectBestCRC32C());
+    crc32c(crc32cInit(), buffer, sizeof(buffer));
+    EXPECT_EQ(after.calls, crc32cStatsSnapshot().calls);
+}
+
+TEST(CRC32C, Tuning) {
+    // Every row must satisfy the constraints of the kernels that use it
+    static const unsigned MODELS[][3] = {
+        // amd, family, model
+        { 0, 6, 0x1a }, { 0, 6, 0x3c }, { 0, 6, 0x55 }, { 0, 6, 0x97 }, { 0, 6, 0x8f },
+        { 0, 6, 0x4a }, { 0, 6, 0x5c }, { 0, 6, 0xff }, { 0, 0xf, 0x04 },
+        { 1, 0x17, 0x01 }, { 1, 0x17, 0x31 }, { 1, 0x19, 0x21 }, { 1, 0x19, 0x61 },
+        { 1, 0x1a, 0x00 }, { 1, 0x15, 0x02 },
+    };
+    for (size_t i = 0; i < sizeof(MODELS)/sizeof(*MODELS); ++i) {
+        const CRC32CTuning& tuning = crc32cTuningFor(MODELS[i][0] != 0, MODELS[i][1], MODELS[i][2]);
+        EXPECT_TRUE(tuning.name != NULL);
+        EXPECT_EQ(0, tuning.adlerLong & (tuning.adlerLong - 1));
+        EXPECT_EQ(0, tuning.adlerShort & (tuning.adlerShort - 1));
+        EXPECT_GE(tuning.adlerShort, 32);
+        EXPECT_GE(tuning.adlerLong, tuning.adlerShort);
+        EXPECT_GE(tuning.hwMaxBlock, 1);
+        EXPECT_LE(tuning.hwMaxBlock, 128);
+        EXPECT_GE(tuning.intelMaxBlock, 1);
+        EXPECT_LE(tuning.intelMaxBlock, 128);
+        EXPECT_GE(tuning.intelSmallSize, 24);
+        EXPECT_LE(tuning.intelSmallSize, 216);
+        EXPECT_LE(tuning.pclSmallSize, 255);
+        EXPECT_EQ(0, tuning.prefetchDistance % 64);
+        EXPECT_GE(tuning.prefetchDistance, 64);
+        EXPECT_LE(tuning.prefetchDistance, 4096);
+    }
+    EXPECT_EQ(crc32cTuningFor(true, 0x19, 0x61).name, crc32cTuningFor(true, 0x19, 0x11).name);
+    EXPECT_NE(crc32cTuningFor(true, 0x19, 0x61).name, crc32cTuningFor(true, 0x19, 0x21).name);
+}
+
 int main() {
     printf("Testing CRC32C functions\n");
     return TestSuite::globalInstance()->runAll();
@@ -0,0 +1,141 @@
+
+#include "logging/crc32c.h"
+#include "logging/crc32cgf2.h"
+#include "logging/crc32cload.h"
+#include "logging/crc32ctail.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <x86intrin.h>
+
+#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__amd64__) || defined(__x86_64__)
+#ifndef CRC32C_IS_X86_64
+#define CRC32C_IS_X86_64     1
+#endif
+#endif // _WIN64 || __amd64__
+
+// The kernel is compiled for AVX2 and VPCLMULQDQ whatever the command line says,
+// and only called after crc32cHasVPCLMULQDQ() has checked the CPU and the OS.
+#define CRC32C_TARGET_VPCLMUL   __attribute__((target("avx2,vpclmulqdq,pclmul,sse4.2")))
+
+namespace logging {
+
+//
+// Constants that move a 128-bit lane forward by D bits: the low quadword is
+// multiplied by x^(D + 32) mod P and the high quadword by x^(D - 32) mod P, both
+// in reversed bit order shifted left by one for pclmulqdq, like
+// crc32c_clmul_constants. Both lanes of a ymm register move by the same distance.
+//
+// clang-format off
+static const uint64_t crc32c_fold_128[2]  = { 0x0f20c0dfeULL, 0x14cd00bd6ULL };
+static const uint64_t crc32c_fold_256[2]  = { 0x1384aa63aULL, 0x0ba4fc28eULL };
+static const uint64_t crc32c_fold_512[2]  = { 0x0740eef02ULL, 0x09e4addf8ULL };
+static const uint64_t crc32c_fold_768[2]  = { 0x1c1733996ULL, 0x102f9b8a2ULL };
+static const uint64_t crc32c_fold_1024[2] = { 0x06992cea2ULL, 0x00d3b6092ULL };
+// clang-format on
+
+#ifndef NDEBUG
+static void crc32c_fold_check() __attribute__((constructor));
+static void crc32c_fold_check()
+{
+    static const struct { size_t bits; const uint64_t * constants; } kFolds[] = {
+        { 128, crc32c_fold_128 }, { 256, crc32c_fold_256 }, { 512, crc32c_fold_512 },
+        { 768, crc32c_fold_768 }, { 1024, crc32c_fold_1024 },
+    };
+    for (size_t i = 0; i < sizeof(kFolds) / sizeof(kFolds[0]); ++i) {
+        assert(kFolds[i].constants[0] == (uint64_t)crc32c_x_pow(kFolds[i].bits + 32) << 1);
+        assert(kFolds[i].constants[1] == (uint64_t)crc32c_x_pow(kFolds[i].bits - 32) << 1);
+    }
+}
+#endif
+
+#if CRC32C_IS_X86_64
+
+// Four ymm registers of 32 bytes each are folded per iteration. From the first
+// full load on this beats crc32q, even with the reduction at the end.
+static const size_t kFoldLoopSize = 4 * sizeof(__m256i);
+static const size_t kFoldMinLength = kFoldLoopSize;
+
+/*
+ * crc32c_fold_lanes() moves both 128-bit lanes of x forward by the distance the
+ * multiplier was made for. The result is congruent mod P, so it can be xored into
+ * the data found there.
+ */
+CRC32C_TARGET_VPCLMUL
+static inline __m256i crc32c_fold_lanes(__m256i x, __m256i multiplier) {
+    return _mm256_xor_si256(_mm256_clmulepi64_epi128(x, multiplier, 0x00),
+                            _mm256_clmulepi64_epi128(x, multiplier, 0x11));
+}
+
+CRC32C_TARGET_VPCLMUL
+static inline __m256i crc32c_fold_multiplier(const uint64_t * constants) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(constants)));
+}
+
+CRC32C_TARGET_VPCLMUL
+static uint32_t __crc32c_vpclmul_avx2(uint32_t crc, const char * data, size_t length)
+{
+    assert(length >= kFoldMinLength);
+    const char * data_end = data + length;
+
+    // The crc goes into the first four bytes; from here on the registers hold data
+    // that has the same crc from zero as everything folded into them
+    __m256i x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 0);
+    __m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 1);
+    __m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 2);
+    __m256i x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 3);
+    x0 = _mm256_xor_si256(x0, _mm256_setr_epi32((int)crc, 0, 0, 0, 0, 0, 0, 0));
+    data += kFoldLoopSize;
+
+    const __m256i k1024 = crc32c_fold_multiplier(crc32c_fold_1024);
+    while (likely((size_t)(data_end - data) >= kFoldLoopSize)) {
+        x0 = _mm256_xor_si256(crc32c_fold_lanes(x0, k1024), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 0));
+        x1 = _mm256_xor_si256(crc32c_fold_lanes(x1, k1024), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 1));
+        x2 = _mm256_xor_si256(crc32c_fold_lanes(x2, k1024), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 2));
+        x3 = _mm256_xor_si256(crc32c_fold_lanes(x3, k1024), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data) + 3));
+        data += kFoldLoopSize;
+    }
+
+    // Four registers into one, then whole ymm words that are left
+    const __m256i k256 = crc32c_fold_multiplier(crc32c_fold_256);
+    __m256i x = _mm256_xor_si256(crc32c_fold_lanes(x0, crc32c_fold_multiplier(crc32c_fold_768)),
+                                 crc32c_fold_lanes(x1, crc32c_fold_multiplier(crc32c_fold_512)));
+    x = _mm256_xor_si256(x, crc32c_fold_lanes(x2, k256));
+    x = _mm256_xor_si256(x, x3);
+    while ((size_t)(data_end - data) >= sizeof(__m256i)) {
+        x = _mm256_xor_si256(crc32c_fold_lanes(x, k256), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data)));
+        data += sizeof(__m256i);
+    }
+
+    // Two lanes into one, whose crc from zero is the crc so far
+    const __m128i k128 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(crc32c_fold_128));
+    const __m128i low = _mm256_castsi256_si128(x);
+    __m128i lane = _mm_xor_si128(_mm_clmulepi64_si128(low, k128, 0x00), _mm_clmulepi64_si128(low, k128, 0x11));
+    lane = _mm_xor_si128(lane, _mm256_extracti128_si256(x, 1));
+    uint64_t crc64 = _mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(lane));
+    crc64 = _mm_crc32_u64(crc64, (uint64_t)_mm_extract_epi64(lane, 1));
+
+    while ((size_t)(data_end - data) >= sizeof(uint64_t)) {
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(data));
+        data += sizeof(uint64_t);
+    }
+    return crc32c_hw_tail((uint32_t)crc64, data_end, (size_t)(data_end - data));
+}
+
+#endif // CRC32C_IS_X86_64
+
+uint32_t crc32c_vpclmul_avx2(uint32_t crc, const void * data, size_t length)
+{
+#if CRC32C_IS_X86_64
+    if (length < kFoldMinLength) {
+        return crc32cHardware64(crc, data, length);
+    }
+    return __crc32c_vpclmul_avx2(crc, (const char *)data, length);
+#else
+    return crc32cHardware32(crc, data, length);
+#endif
+}
+
+}  // namespace logging
@@ -0,0 +1,44 @@
+#include "logging/crc32caccumulator.h"
+
+#include <cassert>
+
+#include "logging/crc32cgf2.h"
+
+namespace logging {
+
+CRC32CAccumulator::CRC32CAccumulator(size_t length)
+        : length_(length), sum_(0), reserved_(0), received_(0), failed_(false) {
+}
+
+bool CRC32CAccumulator::add(size_t offset, size_t length, uint32_t crc) {
+    if (offset > length_ || length > length_ - offset) {
+        failed_.store(true, std::memory_order_relaxed);
+        return false;
+    }
+    // Claim the bytes before touching the sum, so a part that would make the
+    // segments add up to more than the object leaves the sum as it was
+    size_t reserved = reserved_.load(std::memory_order_relaxed);
+    do {
+        if (length > length_ - reserved) {
+            failed_.store(true, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!reserved_.compare_exchange_weak(reserved, reserved + length, std::memory_order_relaxed));
+    // Segments S1 ... Sk of an object have the final CRC of S1 moved over the
+    // bytes after it, xored with that of S2 moved over the bytes after it, and so
+    // on, as in crc32cCombine(). Moving back to the start of the object instead
+    // does not need to know what comes after
+    uint32_t term = crc32c_multiply(crc, crc32c_pow(crc32c_x_pow_inverse(8), offset + length));
+    sum_.fetch_xor(term, std::memory_order_relaxed);
+    // The xor is ordered before the add, and the call that completes the object
+    // acquires every earlier add along with its xor
+    size_t received = received_.fetch_add(length, std::memory_order_acq_rel) + length;
+    return length != 0 && received == length_;
+}
+
+uint32_t CRC32CAccumulator::value() const {
+    assert(complete());
+    return crc32c_multiply(sum_.load(std::memory_order_relaxed), crc32c_pow(crc32c_x_pow(8), length_));
+}
+
+}  // namespace logging
@@ -1,11 +1,23 @@
 #include <cassert>
 #include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <string>
 // FT addition here
 #include <time.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
 
 #include "logging/crc32c.h"
+#include "logging/crc32chuge.h"
+#include "logging/crc32cparallel.h"
+#include "logging/crc32ctuning.h"
 #include "logging/cycletimer.h"
+#include "logging/energycounters.h"
+#include "logging/perfcounters.h"
 
 using namespace logging;
 
@@ -25,31 +37,50 @@ static const CRC32CFunctionInfo FNINFO[] = {
     MAKE_FN_STRUCT(crc32cSarwate),
     MAKE_FN_STRUCT(crc32cSlicingBy4),
     MAKE_FN_STRUCT(crc32cSlicingBy8),
+    MAKE_FN_STRUCT(crc32cBraided),
+    // Only need SSE4.2; keep crc32cAdler last of them
     MAKE_FN_STRUCT(crc32cHardware32),
 #ifdef __LP64__
     MAKE_FN_STRUCT(crc32cHardware64),
-    MAKE_FN_STRUCT(crc32cIntelAsm),
 #endif
     MAKE_FN_STRUCT(crc32cAdler),
+    // Need SSE4.2 and PCLMULQDQ
+#ifdef __LP64__
+    MAKE_FN_STRUCT(crc32cIntelAsm),
+#endif
     MAKE_FN_STRUCT(crc32cIntelC),
 
-#if __SSE4_2__
     MAKE_FN_STRUCT(crc32c_hw),
+    MAKE_FN_STRUCT(crc32c_hw_4way),
+    MAKE_FN_STRUCT(crc32c_hw_6way),
+    MAKE_FN_STRUCT(crc32c_hw_prefetch),
+    MAKE_FN_STRUCT(crc32c_hw_large),
 #ifdef CRC32_IS_X86_64
     MAKE_FN_STRUCT(crc32c_hw_u64),
     MAKE_FN_STRUCT(crc32c_hw_x64),
 #endif // CRC32_IS_X86_64
-#endif // __SSE4_2__
+    // Needs AVX2 and VPCLMULQDQ; keep it last so it can be trimmed on its own
+    MAKE_FN_STRUCT(crc32c_vpclmul_avx2),
 };
 #undef MAKE_FN_STRUCT
 
 static size_t numValidFunctions() {
     size_t numFunctions = sizeof(FNINFO)/sizeof(*FNINFO);
-    bool hasHardware = (detectBestCRC32C() != crc32cSlicingBy8);
-    if (!hasHardware) {
-        while (FNINFO[numFunctions-1].crcfn == crc32cHardware32 ||
-                FNINFO[numFunctions-1].crcfn == crc32cHardware64) {
-            numFunctions -= 1;
+    if (!crc32cHasVPCLMULQDQ()) {
+        numFunctions -= 1;
+    }
+    // The software kernels come first and end with crc32cBraided, then the ones
+    // that only need SSE4.2 end with crc32cAdler; everything after that needs
+    // PCLMULQDQ as well
+    CRC32CFunctionPtr last = NULL;
+    if (detectBestCRC32C() == crc32cBraided) {
+        last = crc32cBraided;
+    } else if (!crc32cHasPCLMULQDQ()) {
+        last = crc32cAdler;
+    }
+    if (last != NULL) {
+        numFunctions = 0;
+        while (FNINFO[numFunctions++].crcfn != last) {
         }
     }
     return numFunctions;
@@ -61,6 +92,17 @@ static const int DATA_LENGTHS[] = {
     16, 64, 128, 192, 256, 288, 512, 1024, 1032, 4096, 8192
 };
 
+// --cold walks a buffer several times the size of the last level cache, so
+// every call reads its data from DRAM
+static const size_t COLD_BUFFER_MAX = 512 * 1024 * 1024;
+static const int COLD_DATA_LENGTHS[] = {
+    4096, 65536, 1024 * 1024
+};
+// --hugepages compares 4 KiB and 2 MiB pages on pieces of many pages
+static const int HUGE_DATA_LENGTHS[] = {
+    1024 * 1024, 16 * 1024 * 1024, 128 * 1024 * 1024
+};
+
 // FT timing function copies from crc32
 static double seconds()
 {
@@ -69,12 +111,79 @@ static double seconds()
   return now.tv_sec + now.tv_nsec / 1000000000.0;
 }
 
+// Opened before any test runs, so the threads of crc32cParallel inherit them
+static PerfCounters counters;
+
+// Columns printed after MiB/sec by printCounters
+static const char PERF_COLUMNS[] = "cyc/B\tIPC\tbr-miss\tL1D-miss\tLLC-miss\tdTLB-miss";
+
+// Cycles per byte, instructions per cycle, and misses per call over the calls
+// between counters.start() and counters.end(). A counter the kernel would not
+// open prints as "-".
+static void printCounters(double calls, double bytes) {
+    if (counters.available(PerfCounters::CYCLES)) {
+        printf("\t%.3f", counters.get(PerfCounters::CYCLES) / bytes);
+    } else {
+        printf("\t-");
+    }
+    if (counters.available(PerfCounters::CYCLES) && counters.available(PerfCounters::INSTRUCTIONS) &&
+            counters.get(PerfCounters::CYCLES) > 0) {
+        printf("\t%.2f", counters.get(PerfCounters::INSTRUCTIONS) / counters.get(PerfCounters::CYCLES));
+    } else {
+        printf("\t-");
+    }
+    static const PerfCounters::Event MISSES[] = {
+        PerfCounters::BRANCH_MISSES, PerfCounters::L1D_MISSES, PerfCounters::LLC_MISSES, PerfCounters::DTLB_MISSES
+    };
+    for (size_t i = 0; i < sizeof(MISSES)/sizeof(*MISSES); ++i) {
+        if (counters.available(MISSES[i])) {
+            printf("\t%.2f", counters.get(MISSES[i]) / calls);
+        } else {
+            printf("\t-");
+        }
+    }
+    printf("\n");
+}
+
 static int cmpDouble(const void *p1, const void *p2) {
     if(*(double *)p1 > *(double *)p2) return 1;
     if(*(double *)p1 == *(double *)p2) return 0;
     return -1;
 }
 
+// One row of the main, --cold, --hugepages or --parallel table, for --json and
+// --compare. A row is known by function, variant (the aligned or pages column)
+// and bytes.
+struct BenchResult {
+    std::string function;
+    std::string variant;
+    size_t bytes;
+    // The median trial, as printed
+    double mibPerSecond;
+    // The fastest trial, which --compare uses: interference only ever slows a
+    // trial down, so the fastest one moves least from run to run
+    double bestMiBPerSecond;
+    // Spread of the middle trials relative to the median: the slowest and the
+    // fastest trial are dropped, so one interrupted trial does not count
+    double noise;
+};
+
+static std::vector<BenchResult> results;
+
+// runTimes sorted; the median is the value printed
+static void recordResult(const char* function, const char* variant, size_t bytes, const double* runTimes,
+        double mibPerSecond) {
+    BenchResult result;
+    result.function = function;
+    result.variant = variant;
+    result.bytes = bytes;
+    result.mibPerSecond = mibPerSecond;
+    double median = runTimes[(TRIALS + 1) / 2 - 1];
+    result.bestMiBPerSecond = mibPerSecond * median / runTimes[0];
+    result.noise = TRIALS < 3 ? 0 : (runTimes[TRIALS - 2] - runTimes[1]) / median;
+    results.push_back(result);
+}
+
 
 void runTest(const CRC32CFunctionInfo& fninfo, const char* buffer, int length, bool aligned) {
     int iterations = BUFFER_MAX / length;
@@ -83,6 +192,7 @@ void runTest(const CRC32CFunctionInfo& fninfo, const char* buffer, int length, b
     
     printf("%-16s\t%s\t%d", fninfo.name, aligned ? "true" : "false", length);
 
+    counters.start();
     for (int j = 0; j < TRIALS; ++j) {
         uint32_t crc = 0;
 // FT removed the original timer and and retrieves the time
@@ -103,12 +213,640 @@ void runTest(const CRC32CFunctionInfo& fninfo, const char* buffer, int length, b
         
 
     }
+    counters.end();
     qsort(runTimes, TRIALS, sizeof(double), cmpDouble);
 // FT calculates the median value when TRIALS is an odd number    
-    printf("\t%.3f\n", (double)BUFFER_MAX / (1024 * 1024) / runTimes[(TRIALS + 1) / 2 - 1]);
+    double mibPerSecond = (double)BUFFER_MAX / (1024 * 1024) / runTimes[(TRIALS + 1) / 2 - 1];
+    printf("\t%.3f", mibPerSecond);
+    printCounters((double)TRIALS * iterations, (double)TRIALS * iterations * length);
+    recordResult(fninfo.name, aligned ? "aligned" : "misaligned", length, runTimes, mibPerSecond);
+}
+
+// Hashes the cold buffer front to back in pieces of length bytes
+void runColdTest(const CRC32CFunctionInfo& fninfo, const char* pages, const char* buffer, int length) {
+    size_t iterations = COLD_BUFFER_MAX / length;
+    double startTime;
+    double runTimes[TRIALS];
+
+    printf("%-16s\t%s\t%d", fninfo.name, pages, length);
+
+    counters.start();
+    for (int j = 0; j < TRIALS; ++j) {
+        uint32_t crc = 0;
+        startTime = seconds();
+        for (size_t i = 0; i < iterations; ++i) {
+            crc = fninfo.crcfn(crc32cInit(), buffer + i * length, length);
+            crc = crc32cFinish(crc);
+        }
+        runTimes[j] = seconds() - startTime;
+    }
+    counters.end();
+    qsort(runTimes, TRIALS, sizeof(double), cmpDouble);
+    double mibPerSecond = (double)(iterations * length) / (1024 * 1024) / runTimes[(TRIALS + 1) / 2 - 1];
+    printf("\t%.3f", mibPerSecond);
+    printCounters((double)TRIALS * iterations, (double)TRIALS * iterations * length);
+    recordResult(fninfo.name, pages, length, runTimes, mibPerSecond);
+}
+
+static void runColdTests(const char* pages, char* buffer, const int* lengths, size_t numLengths) {
+    // Writing every page also keeps page faults out of the first trial
+    for (size_t i = 0; i < COLD_BUFFER_MAX; ++i) {
+        buffer[i] = (char) i;
+    }
+    for (size_t fnIndex = 0; fnIndex < NUM_VALID_FUNCTIONS; ++fnIndex) {
+        for (size_t lengthIndex = 0; lengthIndex < numLengths; ++lengthIndex) {
+            runColdTest(FNINFO[fnIndex], pages, buffer, lengths[lengthIndex]);
+        }
+    }
+}
+
+// The cold buffer backed by 4 KiB pages, whatever the transparent huge page setting
+static char* allocSmallPages(size_t size) {
+    void* buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_NOHUGEPAGE
+    madvise(buffer, size, MADV_NOHUGEPAGE);
+#endif
+    return (char*) buffer;
+}
+
+// Hashes the whole cold buffer in one crc32cParallel call per trial, with 1, 2,
+// 4, ... threads up to one per CPU
+static void runParallelTests(char* buffer) {
+    for (size_t i = 0; i < COLD_BUFFER_MAX; ++i) {
+        buffer[i] = (char) i;
+    }
+    size_t cpus = std::thread::hardware_concurrency();
+    for (size_t threads = 1; ; threads *= 2) {
+        if (threads > cpus) {
+            threads = cpus;
+        }
+        double runTimes[TRIALS];
+        counters.start();
+        for (int j = 0; j < TRIALS; ++j) {
+            double startTime = seconds();
+            crc32cParallel(crc32cInit(), buffer, COLD_BUFFER_MAX, threads);
+            runTimes[j] = seconds() - startTime;
+        }
+        counters.end();
+        qsort(runTimes, TRIALS, sizeof(double), cmpDouble);
+        char name[32];
+        snprintf(name, sizeof(name), "crc32cParallel/%zu", threads);
+        // The counters include the workers: cycles per byte is CPU time, not wall time
+        double mibPerSecond = (double)COLD_BUFFER_MAX / (1024 * 1024) / runTimes[(TRIALS + 1) / 2 - 1];
+        printf("%-16s\t4k\t%zu\t%.3f", name, COLD_BUFFER_MAX, mibPerSecond);
+        printCounters(TRIALS, (double)TRIALS * COLD_BUFFER_MAX);
+        recordResult(name, "4k", COLD_BUFFER_MAX, runTimes, mibPerSecond);
+        if (threads >= cpus) {
+            break;
+        }
+    }
+}
+
+// --energy runs each kernel for at least this long, so that the RAPL counters,
+// which advance about once a millisecond, have counted enough to compare
+static const double ENERGY_SECONDS = 2.0;
+static const int ENERGY_DATA_LENGTHS[] = {
+    4096, 65536
+};
+
+// How long --energy measures the idle power before the kernels
+static const unsigned ENERGY_IDLE_SECONDS = 1;
+
+static EnergyCounters energy;
+// Watts each domain draws with nothing running, from runEnergyTests
+static double idleWatts[EnergyCounters::NUM_DOMAINS];
+
+// Joules domain used over the last duration seconds beyond its idle power, or 0
+// when it cannot be read or the run used no more than idle
+static double activeJoules(EnergyCounters::Domain domain, double duration) {
+    if (!energy.available(domain)) {
+        return 0;
+    }
+    double joules = energy.get(domain) - idleWatts[domain] * duration;
+    return joules > 0 ? joules : 0;
+}
+
+static void printMiBPerJoule(EnergyCounters::Domain domain, double bytes, double duration) {
+    double joules = activeJoules(domain, duration);
+    if (joules > 0) {
+        printf("\t%.1f", bytes / (1024 * 1024) / joules);
+    } else {
+        printf("\t-");
+    }
+}
+
+// Hashes the buffer front to back in pieces of length bytes, over and over,
+// until ENERGY_SECONDS have passed
+static void runEnergyTest(const CRC32CFunctionInfo& fninfo, const char* buffer, int length) {
+    size_t pieces = BUFFER_MAX / length;
+    size_t calls = 0;
+    double startTime = seconds();
+    double duration;
+    uint32_t crc = 0;
+
+    energy.start();
+    do {
+        for (size_t i = 0; i < pieces; ++i) {
+            crc = fninfo.crcfn(crc32cInit(), buffer + i * length, length);
+            crc = crc32cFinish(crc);
+        }
+        calls += pieces;
+        duration = seconds() - startTime;
+    } while (duration < ENERGY_SECONDS);
+    energy.end();
+
+    double bytes = (double) calls * length;
+    printf("%-16s\t%d\t%.3f", fninfo.name, length, bytes / (1024 * 1024) / duration);
+    printMiBPerJoule(EnergyCounters::PACKAGE, bytes, duration);
+    printMiBPerJoule(EnergyCounters::CORE, bytes, duration);
+    if (energy.available(EnergyCounters::PACKAGE)) {
+        printf("\t%.1f", activeJoules(EnergyCounters::PACKAGE, duration) / duration);
+    } else {
+        printf("\t-");
+    }
+    printf("\n");
+}
+
+static void runEnergyTests(char* buffer) {
+    if (!energy.anyAvailable()) {
+        fprintf(stderr, "no RAPL energy counters (/sys/class/powercap/intel-rapl:*/energy_uj missing "
+                "or not readable), their columns show -\n");
+    } else {
+        // What the machine draws doing nothing, subtracted from every row. Timed,
+        // since sleep() may return late
+        double startTime = seconds();
+        energy.start();
+        sleep(ENERGY_IDLE_SECONDS);
+        energy.end();
+        double duration = seconds() - startTime;
+        for (int i = 0; i < EnergyCounters::NUM_DOMAINS; ++i) {
+            idleWatts[i] = energy.get((EnergyCounters::Domain) i) / duration;
+        }
+        printf("idle power over %.3f s: package %.1f W, core %.1f W, subtracted below\n", duration,
+                idleWatts[EnergyCounters::PACKAGE], idleWatts[EnergyCounters::CORE]);
+    }
+    printf("function\t\tbytes\tMiB/sec\tMiB/J pkg\tMiB/J core\tpkg W above idle\n");
+    for (size_t fnIndex = 0; fnIndex < NUM_VALID_FUNCTIONS; ++fnIndex) {
+        for (size_t lengthIndex = 0; lengthIndex < sizeof(ENERGY_DATA_LENGTHS)/sizeof(*ENERGY_DATA_LENGTHS);
+                ++lengthIndex) {
+            runEnergyTest(FNINFO[fnIndex], buffer, ENERGY_DATA_LENGTHS[lengthIndex]);
+        }
+    }
+}
+
+// --trace replays a file of "length [offset]" lines, one call each. The offset is
+// where the data starts within a 4 KiB page, so it sets both the alignment and
+// where the call crosses a page; it defaults to 0.
+struct TraceRecord {
+    size_t length;
+    size_t offset;
+};
+
+static const size_t TRACE_PAGE = 4096;
+// The whole trace and each size class are replayed until a trial takes at least
+// this long, so a class with a few short calls is timed as well as a large one
+static const double TRACE_MIN_SECONDS = 0.01;
+// Size classes as in crc32cStatsSnapshot(): class k holds 2^(k-1) .. 2^k - 1 bytes
+static const size_t TRACE_CLASSES = 65;
+
+static size_t sizeClass(size_t length) {
+    return length == 0 ? 0 : 64 - __builtin_clzll((unsigned long long) length);
+}
+
+static bool readTrace(const char* path, std::vector<TraceRecord>* trace) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    for (int lineNumber = 1; fgets(line, sizeof(line), file) != NULL; ++lineNumber) {
+        char* text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0') {
+            continue;
+        }
+        TraceRecord record = { 0, 0 };
+        if (sscanf(text, "%zu %zu", &record.length, &record.offset) < 1) {
+            fprintf(stderr, "%s:%d: expected \"length [offset]\"\n", path, lineNumber);
+            fclose(file);
+            return false;
+        }
+        record.offset %= TRACE_PAGE;
+        trace->push_back(record);
+    }
+    fclose(file);
+    if (trace->empty()) {
+        fprintf(stderr, "%s: no records\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Replays records in order, repeats times, and returns the time it took
+static double replayOnce(CRC32CFunctionPtr crcfn, const char* buffer, const TraceRecord* records,
+        size_t count, size_t repeats) {
+    uint32_t crc = 0;
+    double startTime = seconds();
+    for (size_t r = 0; r < repeats; ++r) {
+        for (size_t i = 0; i < count; ++i) {
+            crc = crcfn(crc32cInit(), buffer + records[i].offset, records[i].length);
+            crc = crc32cFinish(crc);
+        }
+    }
+    return seconds() - startTime;
+}
+
+// Replays records in order, repeats times, and returns the median time of a trial
+static double replay(CRC32CFunctionPtr crcfn, const char* buffer, const TraceRecord* records,
+        size_t count, size_t repeats) {
+    double runTimes[TRIALS];
+    for (int j = 0; j < TRIALS; ++j) {
+        runTimes[j] = replayOnce(crcfn, buffer, records, count, repeats);
+    }
+    qsort(runTimes, TRIALS, sizeof(double), cmpDouble);
+    return runTimes[(TRIALS + 1) / 2 - 1];
+}
+
+// Doubles the repeats of records until one replay takes TRACE_MIN_SECONDS with
+// this kernel
+static size_t traceRepeats(CRC32CFunctionPtr crcfn, const char* buffer, const TraceRecord* records,
+        size_t count) {
+    size_t repeats = 1;
+    while (replayOnce(crcfn, buffer, records, count, repeats) < TRACE_MIN_SECONDS) {
+        repeats *= 2;
+    }
+    return repeats;
+}
+
+// logging::crc32c as the application calls it, through the pointer
+static uint32_t dispatched(uint32_t crc, const void* data, size_t length) {
+    return crc32c(crc, data, length);
+}
+
+// The whole trace in order gives the total. Then the records of each size class
+// are replayed on their own, for nanoseconds per call in that class. Each has its
+// own repeats: the trace's would replay a class of a few short calls for only
+// microseconds.
+static void runTraceTest(const CRC32CFunctionInfo& fninfo, const char* buffer,
+        const std::vector<TraceRecord>& trace, const std::vector<TraceRecord>* classes,
+        size_t traceBytes) {
+    size_t repeats = traceRepeats(fninfo.crcfn, buffer, &trace[0], trace.size());
+    printf("%-16s", fninfo.name);
+    counters.start();
+    double total = replay(fninfo.crcfn, buffer, &trace[0], trace.size(), repeats);
+    counters.end();
+    printf("\t%.3f\t%.3f", total * 1000 / repeats, (double)traceBytes * repeats / (1024 * 1024) / total);
+    for (size_t k = 0; k < TRACE_CLASSES; ++k) {
+        if (!classes[k].empty()) {
+            size_t classRepeats = traceRepeats(fninfo.crcfn, buffer, &classes[k][0], classes[k].size());
+            double classTime = replay(fninfo.crcfn, buffer, &classes[k][0], classes[k].size(), classRepeats);
+            printf("\t%.1f", classTime * 1e9 / ((double)classes[k].size() * classRepeats));
+        }
+    }
+    printCounters((double)TRIALS * repeats * trace.size(), (double)TRIALS * repeats * traceBytes);
+}
+
+static int runTraceTests(const char* path) {
+    std::vector<TraceRecord> trace;
+    if (!readTrace(path, &trace)) {
+        return 1;
+    }
+    std::vector<TraceRecord> classes[TRACE_CLASSES];
+    size_t traceBytes = 0;
+    size_t maxLength = 0;
+    for (size_t i = 0; i < trace.size(); ++i) {
+        classes[sizeClass(trace[i].length)].push_back(trace[i]);
+        traceBytes += trace[i].length;
+        if (trace[i].length > maxLength) {
+            maxLength = trace[i].length;
+        }
+    }
+    if (traceBytes == 0) {
+        traceBytes = 1;
+    }
+
+    // One page-aligned buffer that every record fits in from any page offset
+    char* buffer = allocSmallPages(maxLength + TRACE_PAGE);
+    if (buffer == NULL) {
+        fprintf(stderr, "cannot map %zu bytes\n", maxLength + TRACE_PAGE);
+        return 1;
+    }
+    for (size_t i = 0; i < maxLength + TRACE_PAGE; ++i) {
+        buffer[i] = (char) i;
+    }
+
+    printf("tuning: %s\n", crc32cTuning().name);
+    printf("trace: %s, %zu calls, %zu bytes\n", path, trace.size(), traceBytes);
+    printf("function\t\tms\tMiB/sec");
+    for (size_t k = 0; k < TRACE_CLASSES; ++k) {
+        if (!classes[k].empty()) {
+            // ns per call of the class, headed by its range and share of calls
+            printf("\t%zu-%zu:%zu", k == 0 ? 0 : (size_t)1 << (k - 1), k == 0 ? 0 : ((size_t)1 << (k - 1)) * 2 - 1,
+                    classes[k].size());
+        }
+    }
+    printf("\t%s\n", PERF_COLUMNS);
+
+    const CRC32CFunctionInfo dispatch = { dispatched, "crc32c" };
+    runTraceTest(dispatch, buffer, trace, classes, traceBytes);
+    for (size_t fnIndex = 0; fnIndex < NUM_VALID_FUNCTIONS; ++fnIndex) {
+        runTraceTest(FNINFO[fnIndex], buffer, trace, classes, traceBytes);
+    }
+    munmap(buffer, maxLength + TRACE_PAGE);
+    return 0;
 }
 
-int main() {
+// --compare flags a row as slower or faster when its MiB/s moved by more than
+// COMPARE_NOISE_FACTOR times the noise of both runs, and never for less than
+// COMPARE_MIN_CHANGE
+static const double COMPARE_NOISE_FACTOR = 2.0;
+static const double COMPARE_MIN_CHANGE = 0.03;
+
+static void writeJsonString(FILE* file, const std::string& text) {
+    fputc('"', file);
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '"' || text[i] == '\\') {
+            fputc('\\', file);
+        }
+        fputc(text[i], file);
+    }
+    fputc('"', file);
+}
+
+static bool writeResults(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    fprintf(file, "{\n  \"tuning\": ");
+    writeJsonString(file, crc32cTuning().name);
+    fprintf(file, ",\n  \"trials\": %d,\n  \"results\": [", TRIALS);
+    for (size_t i = 0; i < results.size(); ++i) {
+        fprintf(file, "%s\n    {\"function\": ", i == 0 ? "" : ",");
+        writeJsonString(file, results[i].function);
+        fprintf(file, ", \"variant\": ");
+        writeJsonString(file, results[i].variant);
+        fprintf(file, ", \"bytes\": %zu, \"mibPerSecond\": %.3f, \"bestMiBPerSecond\": %.3f, \"noise\": %.4f}",
+                results[i].bytes, results[i].mibPerSecond, results[i].bestMiBPerSecond, results[i].noise);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// Reads back what writeResults wrote: strings without escapes other than \" and
+// \\, numbers, and one level of objects inside "results"
+static const char* readJsonString(const char* p, std::string* text) {
+    text->clear();
+    for (++p; *p != '\0' && *p != '"'; ++p) {
+        if (*p == '\\' && p[1] != '\0') {
+            ++p;
+        }
+        text->push_back(*p);
+    }
+    return *p == '"' ? p + 1 : NULL;
+}
+
+static bool readResults(const char* path, std::string* tuning, std::vector<BenchResult>* baseline) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    std::string json;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        json.append(chunk, n);
+    }
+    fclose(file);
+
+    const char* p = strstr(json.c_str(), "\"tuning\"");
+    if (p != NULL && (p = strchr(p + strlen("\"tuning\""), '"')) != NULL) {
+        readJsonString(p, tuning);
+    }
+    // Objects before "results" are not rows
+    p = strstr(json.c_str(), "\"results\"");
+    BenchResult result;
+    bool inResult = false;
+    std::string key;
+    while (p != NULL && *p != '\0') {
+        if (*p == '{') {
+            result = BenchResult();
+            inResult = true;
+            ++p;
+        } else if (*p == '}' && inResult) {
+            baseline->push_back(result);
+            inResult = false;
+            ++p;
+        } else if (*p == '"') {
+            p = readJsonString(p, &key);
+            if (p == NULL) {
+                break;
+            }
+            p += strspn(p, " \t\r\n");
+            if (*p != ':') {
+                continue;
+            }
+            p += 1 + strspn(p + 1, " \t\r\n");
+            std::string text;
+            if (*p == '"') {
+                p = readJsonString(p, &text);
+            }
+            if (key == "tuning") {
+                *tuning = text;
+            } else if (key == "function") {
+                result.function = text;
+            } else if (key == "variant") {
+                result.variant = text;
+            } else if (key == "bytes") {
+                result.bytes = strtoull(p, NULL, 10);
+            } else if (key == "mibPerSecond") {
+                result.mibPerSecond = strtod(p, NULL);
+            } else if (key == "bestMiBPerSecond") {
+                result.bestMiBPerSecond = strtod(p, NULL);
+            } else if (key == "noise") {
+                result.noise = strtod(p, NULL);
+            }
+        } else {
+            ++p;
+        }
+    }
+    if (p == NULL || baseline->empty()) {
+        fprintf(stderr, "%s: no results\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Prints the rows that got slower or faster than in the baseline and the
+// baseline rows this run did not measure, and sets *slower to the number that
+// got slower. Returns false if the baseline cannot be read.
+static bool compareResults(const char* path, size_t* slower) {
+    std::string tuning;
+    std::vector<BenchResult> baseline;
+    if (!readResults(path, &tuning, &baseline)) {
+        return false;
+    }
+    printf("\ncompared with %s", path);
+    if (tuning != crc32cTuning().name) {
+        printf(" (tuning %s, now %s)", tuning.c_str(), crc32cTuning().name);
+    }
+    printf("\nfunction\t\tvariant\tbytes\tbest before\tbest now\tchange\tlimit\n");
+    size_t compared = 0;
+    size_t faster = 0;
+    double logChange = 0;
+    std::vector<bool> matched(baseline.size(), false);
+    *slower = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& now = results[i];
+        for (size_t j = 0; j < baseline.size(); ++j) {
+            const BenchResult& before = baseline[j];
+            if (before.function != now.function || before.variant != now.variant || before.bytes != now.bytes ||
+                    before.bestMiBPerSecond <= 0) {
+                continue;
+            }
+            ++compared;
+            matched[j] = true;
+            double change = now.bestMiBPerSecond / before.bestMiBPerSecond - 1;
+            logChange += log(now.bestMiBPerSecond / before.bestMiBPerSecond);
+            double limit = COMPARE_NOISE_FACTOR * (before.noise + now.noise);
+            if (limit < COMPARE_MIN_CHANGE) {
+                limit = COMPARE_MIN_CHANGE;
+            }
+            if (change < -limit || change > limit) {
+                printf("%-16s\t%s\t%zu\t%.3f\t%.3f\t%+.1f%%\t%.1f%%\t%s\n", now.function.c_str(),
+                        now.variant.c_str(), now.bytes, before.bestMiBPerSecond, now.bestMiBPerSecond,
+                        100 * change, 100 * limit, change < 0 ? "SLOWER" : "faster");
+                ++(change < 0 ? *slower : faster);
+            }
+            break;
+        }
+    }
+    // A row that disappeared (a kernel no longer built or detected, a length
+    // dropped from the table) would otherwise pass silently
+    size_t missing = 0;
+    for (size_t j = 0; j < baseline.size(); ++j) {
+        if (!matched[j] && baseline[j].bestMiBPerSecond > 0) {
+            printf("%-16s\t%s\t%zu\t%.3f\t-\t\t\t\tMISSING\n", baseline[j].function.c_str(),
+                    baseline[j].variant.c_str(), baseline[j].bytes, baseline[j].bestMiBPerSecond);
+            ++missing;
+        }
+    }
+    printf("%zu rows compared, %zu slower, %zu faster, %zu not in the baseline, %zu missing from this run\n",
+            compared, *slower, faster, results.size() - compared, missing);
+    // When every row moved the same way, suspect the machine (frequency, another
+    // load) before the code
+    if (compared > 0) {
+        printf("all rows together: %+.1f%% (geometric mean)\n", 100 * (exp(logChange / compared) - 1));
+    }
+    return true;
+}
+
+// Writes and compares the recorded rows as asked; exits 2 on a regression and 1
+// when the baseline cannot be read, so a build script can stop on either
+static int finishResults(const char* jsonPath, const char* comparePath) {
+    if (jsonPath != NULL && !writeResults(jsonPath)) {
+        return 1;
+    }
+    size_t slower = 0;
+    if (comparePath != NULL && !compareResults(comparePath, &slower)) {
+        return 1;
+    }
+    return slower > 0 ? 2 : 0;
+}
+
+static void usage(const char* program) {
+    fprintf(stderr, "usage: %s [--cold] [--hugepages] [--parallel] [--trace FILE] [--energy]\n"
+            "          [--json FILE] [--compare FILE]\n"
+            "  --cold       data from DRAM: each call hashes the next piece of a %zu MiB buffer\n"
+            "  --hugepages  the same with larger pieces, on 4 KiB and on 2 MiB pages\n"
+            "  --parallel   the whole buffer with crc32cParallel on 1, 2, 4, ... threads\n"
+            "  --trace FILE replay the calls in FILE, one \"length [offset]\" per line, with\n"
+            "               the time per call for each size class\n"
+            "  --energy     MiB per joule of package and core energy, from RAPL\n"
+            "  --json FILE  also write the MiB/sec table to FILE\n"
+            "  --compare FILE\n"
+            "               compare the table with one written by --json, list the rows that\n"
+            "               changed by more than the noise of the trials, and exit 2 if any\n"
+            "               got slower (1 if FILE cannot be read)\n"
+            "  --json and --compare do not apply to --trace or --energy\n",
+            program, COLD_BUFFER_MAX / (1024 * 1024));
+}
+
+int main(int argc, char* argv[]) {
+    bool cold = false;
+    bool hugepages = false;
+    bool parallel = false;
+    const char* tracePath = NULL;
+    bool energyMode = false;
+    const char* jsonPath = NULL;
+    const char* comparePath = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cold") == 0) {
+            cold = true;
+        } else if (strcmp(argv[i], "--hugepages") == 0) {
+            hugepages = true;
+        } else if (strcmp(argv[i], "--parallel") == 0) {
+            parallel = true;
+        } else if (strcmp(argv[i], "--energy") == 0) {
+            energyMode = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            comparePath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    // The trace and energy tables have other columns than the MiB/sec rows
+    // --json records, so there would be nothing to write or compare
+    if ((tracePath != NULL || energyMode) && (jsonPath != NULL || comparePath != NULL)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!counters.anyAvailable()) {
+        fprintf(stderr, "no hardware counters (perf_event_open failed), their columns show -\n");
+    }
+    if (tracePath != NULL) {
+        return runTraceTests(tracePath);
+    }
+    if (cold || hugepages || parallel) {
+        printf("tuning: %s, prefetch distance %zu\n", crc32cTuning().name, crc32cTuning().prefetchDistance);
+        printf("function\t\tpages\tbytes\tMiB/sec\t%s\n", PERF_COLUMNS);
+        char* small = allocSmallPages(COLD_BUFFER_MAX);
+        if (small == NULL) {
+            fprintf(stderr, "cannot map %zu bytes\n", COLD_BUFFER_MAX);
+            return 1;
+        }
+        if (cold) {
+            runColdTests("4k", small, COLD_DATA_LENGTHS, sizeof(COLD_DATA_LENGTHS)/sizeof(*COLD_DATA_LENGTHS));
+        }
+        if (parallel) {
+            runParallelTests(small);
+        }
+        if (hugepages) {
+            runColdTests("4k", small, HUGE_DATA_LENGTHS, sizeof(HUGE_DATA_LENGTHS)/sizeof(*HUGE_DATA_LENGTHS));
+        }
+        munmap(small, COLD_BUFFER_MAX);
+        if (hugepages) {
+            char* huge = (char*) crc32cAllocHuge(COLD_BUFFER_MAX);
+            if (huge == NULL) {
+                fprintf(stderr, "cannot map %zu bytes of huge pages\n", COLD_BUFFER_MAX);
+                return 1;
+            }
+            runColdTests("2m", huge, HUGE_DATA_LENGTHS, sizeof(HUGE_DATA_LENGTHS)/sizeof(*HUGE_DATA_LENGTHS));
+            crc32cFreeHuge(huge, COLD_BUFFER_MAX);
+        }
+        return finishResults(jsonPath, comparePath);
+    }
+
     char* buffer = new char[BUFFER_MAX + ALIGNMENT];
     char* aligned_buffer = (char*) (((intptr_t) buffer + (ALIGNMENT-1)) & ~(ALIGNMENT-1));
     assert(aligned_buffer + BUFFER_MAX <= buffer + BUFFER_MAX + ALIGNMENT);
@@ -118,7 +856,13 @@ int main() {
         aligned_buffer[i] = (char) i;
     }
 
-    printf("function\t\taligned\tbytes\tMiB/sec\n");
+    printf("tuning: %s\n", crc32cTuning().name);
+    if (energyMode) {
+        runEnergyTests(aligned_buffer);
+        delete[] buffer;
+        return 0;
+    }
+    printf("function\t\taligned\tbytes\tMiB/sec\t%s\n", PERF_COLUMNS);
     for (size_t fnIndex = 0; fnIndex < NUM_VALID_FUNCTIONS; ++fnIndex) {
         for (int aligned = 0; aligned < 2; ++aligned) {
             for (size_t lengthIndex = 0; lengthIndex < sizeof(DATA_LENGTHS)/sizeof(*DATA_LENGTHS);
@@ -136,5 +880,5 @@ int main() {
     }
 
     delete[] buffer;
-    return 0;
+    return finishResults(jsonPath, comparePath);
 }
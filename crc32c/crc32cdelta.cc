@@ -0,0 +1,149 @@
+#include "logging/crc32cdelta.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "logging/crc32c.h"
+#include "logging/crc32crolling.h"
+
+namespace logging {
+
+CRC32CDeltaIndex::CRC32CDeltaIndex(const void* reference, size_t length, size_t blockSize)
+        : reference_((const char*) reference), blockSize_(blockSize) {
+    assert(blockSize > 0);
+    numBlocks_ = length / blockSize;
+    assert(numBlocks_ < kEmpty);
+
+    // At most half full, so a probe that misses stops after a slot or two. Slots
+    // are 8 bytes, eight to a cache line.
+    size_t capacity = 16;
+    while (capacity < 2 * numBlocks_) {
+        capacity *= 2;
+    }
+    mask_ = capacity - 1;
+    Slot empty = { 0, kEmpty };
+    slots_.assign(capacity, empty);
+
+    // Sixteen filter bits per block, so about one in sixteen window CRCs that are
+    // not in the table gets past the filter
+    filterShift_ = 32 - 6;
+    while (filterShift_ > 6 && ((size_t) 1 << (32 - filterShift_)) < 16 * numBlocks_) {
+        --filterShift_;
+    }
+    filter_.assign(((size_t) 1 << (32 - filterShift_)) / 64, 0);
+
+    for (size_t block = 0; block < numBlocks_; ++block) {
+        uint32_t crc = crc32cFinish(crc32c(crc32cInit(), reference_ + block * blockSize_, blockSize_));
+        // The CRC bits are already well mixed, so its low bits pick the slot.
+        // Repeats of a block (zero pages, padding) would all probe the same
+        // cluster and make building and find() quadratic, and a copy of the
+        // first one serves just as well, so only the first is indexed.
+        size_t slot = crc & mask_;
+        bool repeat = false;
+        while (slots_[slot].block != kEmpty) {
+            if (slots_[slot].crc == crc && memcmp(reference_ + (size_t) slots_[slot].block * blockSize_,
+                                                  reference_ + block * blockSize_, blockSize_) == 0) {
+                repeat = true;
+                break;
+            }
+            slot = (slot + 1) & mask_;
+        }
+        if (repeat) {
+            continue;
+        }
+        slots_[slot].crc = crc;
+        slots_[slot].block = (uint32_t) block;
+        filter_[(crc >> filterShift_) / 64] |= (uint64_t) 1 << ((crc >> filterShift_) % 64);
+    }
+}
+
+uint32_t CRC32CDeltaIndex::find(uint32_t crc, const char* data, uint32_t hint) const {
+    // The block after the last match is the usual one, as long as the data has
+    // not changed there
+    if (hint < numBlocks_ && memcmp(reference_ + (size_t) hint * blockSize_, data, blockSize_) == 0) {
+        return hint;
+    }
+    // Most window CRCs of new data are in no block, and the filter is small
+    // enough to stay in L1 or L2 where the table may not
+    if ((filter_[(crc >> filterShift_) / 64] & ((uint64_t) 1 << ((crc >> filterShift_) % 64))) == 0) {
+        return kEmpty;
+    }
+    for (size_t slot = crc & mask_; slots_[slot].block != kEmpty; slot = (slot + 1) & mask_) {
+        if (slots_[slot].crc == crc &&
+                memcmp(reference_ + (size_t) slots_[slot].block * blockSize_, data, blockSize_) == 0) {
+            return slots_[slot].block;
+        }
+    }
+    return kEmpty;
+}
+
+static void addLiteral(CRC32CDelta* delta, const char* data, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    CRC32CDeltaOp op = { CRC32CDeltaOp::LITERAL, delta->literals.size(), length };
+    delta->ops.push_back(op);
+    delta->literals.insert(delta->literals.end(), data, data + length);
+}
+
+static void addCopy(CRC32CDelta* delta, size_t offset, size_t length) {
+    if (!delta->ops.empty()) {
+        CRC32CDeltaOp& last = delta->ops.back();
+        if (last.kind == CRC32CDeltaOp::COPY && last.offset + last.length == offset) {
+            last.length += length;
+            return;
+        }
+    }
+    CRC32CDeltaOp op = { CRC32CDeltaOp::COPY, offset, length };
+    delta->ops.push_back(op);
+}
+
+void CRC32CDeltaIndex::diff(const void* data, size_t length, CRC32CDelta* delta) const {
+    const char* bytes = (const char*) data;
+    delta->ops.clear();
+    delta->literals.clear();
+
+    size_t literalStart = 0;
+    if (numBlocks_ > 0 && length >= blockSize_) {
+        RollingCRC32C rolling(blockSize_);
+        rolling.start(bytes);
+        uint32_t hint = kEmpty;
+        size_t pos = 0;
+        while (true) {
+            uint32_t block = find(rolling.value(), bytes + pos, hint);
+            if (block != kEmpty) {
+                addLiteral(delta, bytes + literalStart, pos - literalStart);
+                addCopy(delta, (size_t) block * blockSize_, blockSize_);
+                pos += blockSize_;
+                literalStart = pos;
+                hint = block + 1;
+                if (length - pos < blockSize_) {
+                    break;
+                }
+                // Cheaper with the bulk kernel than rolling over the block
+                rolling.start(bytes + pos);
+                continue;
+            }
+            // No match at pos, so try the next hint only after the next match
+            hint = kEmpty;
+            if (length - pos == blockSize_) {
+                break;
+            }
+            rolling.roll((uint8_t) bytes[pos], (uint8_t) bytes[pos + blockSize_]);
+            ++pos;
+        }
+    }
+    addLiteral(delta, bytes + literalStart, length - literalStart);
+}
+
+void crc32cDeltaApply(const void* reference, const CRC32CDelta& delta, std::vector<char>* out) {
+    const char* source = (const char*) reference;
+    out->clear();
+    for (size_t i = 0; i < delta.ops.size(); ++i) {
+        const CRC32CDeltaOp& op = delta.ops[i];
+        const char* from = op.kind == CRC32CDeltaOp::COPY ? source + op.offset : &delta.literals[op.offset];
+        out->insert(out->end(), from, from + op.length);
+    }
+}
+
+}  // namespace logging
@@ -0,0 +1,53 @@
+#include "logging/crc32chuge.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace logging {
+
+static size_t roundToHugePages(size_t size) {
+    return (size + kCRC32CHugePageSize - 1) & ~(kCRC32CHugePageSize - 1);
+}
+
+void* crc32cAllocHuge(size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    size_t length = roundToHugePages(size);
+
+#ifdef MAP_HUGETLB
+    void* buffer = mmap(NULL, length, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buffer != MAP_FAILED) {
+        return buffer;
+    }
+#endif
+
+    // No reserved huge pages. Map one page more than needed so the buffer can
+    // start on a huge page boundary, and give the ends back.
+    size_t mapped = length + kCRC32CHugePageSize;
+    char* base = (char*) mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    char* aligned = (char*) (((uintptr_t) base + kCRC32CHugePageSize - 1) & ~(uintptr_t) (kCRC32CHugePageSize - 1));
+    if (aligned > base) {
+        munmap(base, aligned - base);
+    }
+    size_t tail = (base + mapped) - (aligned + length);
+    if (tail > 0) {
+        munmap(aligned + length, tail);
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+void crc32cFreeHuge(void* buffer, size_t size) {
+    if (buffer != NULL) {
+        munmap(buffer, roundToHugePages(size));
+    }
+}
+
+}  // namespace logging
@@ -0,0 +1,233 @@
+#include "logging/crc32cparallel.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logging/crc32c.h"
+
+namespace logging {
+
+// Chunks start on 2 MiB boundaries, so a huge page never belongs to two chunks,
+// and are at least that long, so starting a thread and the combine are small
+// next to the hashing. Each thread gets a few chunks to even out the ends.
+static const size_t kChunkAlignment = 2 * 1024 * 1024;
+static const size_t kChunksPerThread = 4;
+
+struct NumaNode {
+    int id;
+    cpu_set_t cpus;
+};
+
+// Reads a sysfs list such as "0-3,8-11" into numbers
+static bool readList(const char* path, std::vector<int>& numbers) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[4096];
+    bool read = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    if (!read) {
+        return false;
+    }
+    const char* p = line;
+    while (*p != '\0' && *p != '\n') {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p) {
+            return false;
+        }
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long i = first; i <= last; ++i) {
+            numbers.push_back((int) i);
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return true;
+}
+
+// The online nodes and their CPUs from sysfs; empty without NUMA information
+static std::vector<NumaNode> readNodes() {
+    std::vector<NumaNode> nodes;
+    std::vector<int> ids;
+    if (!readList("/sys/devices/system/node/online", ids)) {
+        return nodes;
+    }
+    for (size_t i = 0; i < ids.size(); ++i) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+        std::vector<int> cpus;
+        if (!readList(path, cpus) || cpus.empty()) {
+            continue;  // a memory-only node has no CPUs to run on
+        }
+        NumaNode node;
+        node.id = ids[i];
+        CPU_ZERO(&node.cpus);
+        for (size_t j = 0; j < cpus.size(); ++j) {
+            if (cpus[j] < CPU_SETSIZE) {
+                CPU_SET(cpus[j], &node.cpus);
+            }
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+static const std::vector<NumaNode>& numaNodes() {
+    static const std::vector<NumaNode> nodes = readNodes();
+    return nodes;
+}
+
+// The node holding the page at each address, or -1 where the kernel cannot tell:
+// the page is not faulted in yet, or move_pages is missing or not allowed
+static std::vector<int> pageNodes(const std::vector<const char*>& addresses) {
+    std::vector<int> nodes(addresses.size(), -1);
+#ifdef SYS_move_pages
+    std::vector<void*> pages(addresses.size());
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        pages[i] = (void*) addresses[i];
+    }
+    std::vector<int> status(addresses.size());
+    // With no target nodes move_pages only reports where each page is
+    if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), NULL, status.data(), 0) == 0) {
+        for (size_t i = 0; i < status.size(); ++i) {
+            nodes[i] = (status[i] >= 0) ? status[i] : -1;
+        }
+    }
+#endif
+    return nodes;
+}
+
+struct ParallelChunk {
+    const char* data;
+    size_t length;
+    uint32_t crc;
+};
+
+// Chunk indices per node, and a last queue for chunks of no known node. A worker
+// takes from its own node, then the unknown ones, then the other nodes.
+struct ParallelWork {
+    CRC32CFunctionPtr crcfn;
+    std::vector<ParallelChunk> chunks;
+    std::vector<std::vector<size_t> > queues;
+    std::vector<std::atomic<size_t> > next;
+
+    explicit ParallelWork(size_t numQueues) : queues(numQueues), next(numQueues) {
+        for (size_t i = 0; i < numQueues; ++i) {
+            next[i].store(0);
+        }
+    }
+
+    void drain(size_t queue) {
+        const std::vector<size_t>& indices = queues[queue];
+        for (size_t i = next[queue].fetch_add(1); i < indices.size(); i = next[queue].fetch_add(1)) {
+            ParallelChunk& chunk = chunks[indices[i]];
+            chunk.crc = crcfn(crc32cInit(), chunk.data, chunk.length);
+        }
+    }
+
+    // home is an index into numaNodes(), or -1 for the calling thread, which is
+    // not pinned and starts with the chunks of unknown nodes
+    void run(int home) {
+        size_t numQueues = queues.size();
+        size_t first = (home < 0) ? numQueues - 1 : (size_t) home;
+        for (size_t i = 0; i < numQueues; ++i) {
+            drain((first + i) % numQueues);
+        }
+    }
+};
+
+static void parallelWorker(ParallelWork* work, int home) {
+    const std::vector<NumaNode>& nodes = numaNodes();
+    if (nodes.size() > 1) {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &nodes[home].cpus);
+    }
+    work->run(home);
+}
+
+uint32_t crc32cParallel(uint32_t crc, const void* data, size_t length, size_t threads) {
+    CRC32CFunctionPtr crcfn = detectBestCRC32C();
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads == 0) {
+        threads = 1;
+    }
+    size_t chunkSize = length / (threads * kChunksPerThread);
+    chunkSize = (chunkSize + kChunkAlignment - 1) & ~(kChunkAlignment - 1);
+    if (chunkSize == 0) {
+        chunkSize = kChunkAlignment;
+    }
+    size_t numChunks = length / chunkSize;
+    if (threads > numChunks / 2) {
+        threads = numChunks / 2;
+    }
+    if (threads <= 1) {
+        return crcfn(crc, data, length);
+    }
+
+    // Chunk boundaries fall on multiples of kChunkAlignment
+    const std::vector<NumaNode>& nodes = numaNodes();
+    ParallelWork work(nodes.size() + 1);
+    work.crcfn = crcfn;
+    const char* p = (const char*) data;
+    const char* end = p + length;
+    const char* boundary = (const char*) ((uintptr_t) p & ~(uintptr_t) (kChunkAlignment - 1)) + chunkSize;
+    std::vector<const char*> starts;
+    while (p < end) {
+        const char* chunkEnd = (boundary < end) ? boundary : end;
+        ParallelChunk chunk = { p, (size_t) (chunkEnd - p), 0 };
+        work.chunks.push_back(chunk);
+        starts.push_back(p);
+        p = chunkEnd;
+        boundary += chunkSize;
+    }
+
+    std::vector<int> chunkNodes = pageNodes(starts);
+    for (size_t i = 0; i < work.chunks.size(); ++i) {
+        size_t queue = nodes.size();
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            if (nodes[n].id == chunkNodes[i]) {
+                queue = n;
+            }
+        }
+        work.queues[queue].push_back(i);
+    }
+
+    // Workers go round the nodes; the calling thread is the last worker
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i + 1 < threads; ++i) {
+        int home = nodes.empty() ? -1 : (int) (i % nodes.size());
+        try {
+            workers.push_back(std::thread(parallelWorker, &work, home));
+        } catch (const std::system_error&) {
+            break;  // the threads we have, and the caller, do the rest
+        }
+    }
+    work.run(-1);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+
+    // Final values combine; crc before the buffer is the final value ~crc
+    uint32_t combined = crc32cFinish(crc);
+    for (size_t i = 0; i < work.chunks.size(); ++i) {
+        combined = crc32cCombine(combined, crc32cFinish(work.chunks[i].crc), work.chunks[i].length);
+    }
+    return crc32cFinish(combined);
+}
+
+}  // namespace logging
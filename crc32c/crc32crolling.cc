@@ -0,0 +1,140 @@
+#include "logging/crc32crolling.h"
+
+#include <cassert>
+#include <x86intrin.h>
+
+#include "logging/crc32c.h"
+#include "logging/crc32cgf2.h"
+#include "logging/crc32ctables.h"
+
+namespace logging {
+
+// scan() rolls this many stretches of the data side by side. crc32 has a latency
+// of three cycles and a throughput of one, and the xor of the outgoing byte adds
+// one more to each step.
+static const size_t kScanLanes = 4;
+// Below this many window positions per lane, scan() rolls a single stretch
+static const size_t kScanMinLane = 256;
+
+RollingCRC32C::RollingCRC32C(size_t window) : window_(window), crc_(0) {
+    assert(window > 0);
+    hasHardware_ = (detectBestCRC32C() != crc32cBraided);
+    uint32_t shift = crc32c_x_pow(8 * window);
+    for (size_t b = 0; b < 256; ++b) {
+        out_[b] = crc32c_multiply(crc_tableil8_o32[b], shift);
+    }
+    finish_ = ~crc32c_multiply(crc32cInit(), shift);
+}
+
+void RollingCRC32C::start(const void* data) {
+    // crc32c() from zero is the linear part alone
+    crc_ = crc32c(0, data, window_);
+}
+
+CRC32C_TARGET_SSE42
+static inline uint32_t rollHardware(uint32_t crc, const uint32_t* out, uint8_t outByte, uint8_t inByte) {
+    return _mm_crc32_u8(crc, inByte) ^ out[outByte];
+}
+
+static inline uint32_t rollSoftware(uint32_t crc, const uint32_t* out, uint8_t outByte, uint8_t inByte) {
+    return crc_tableil8_o32[(crc ^ inByte) & 0xFF] ^ (crc >> 8) ^ out[outByte];
+}
+
+void RollingCRC32C::roll(uint8_t out, uint8_t in) {
+    if (hasHardware_) {
+        crc_ = rollHardware(crc_, out_, out, in);
+    } else {
+        crc_ = rollSoftware(crc_, out_, out, in);
+    }
+}
+
+/*
+ * scanLanes() rolls kScanLanes stretches of count window positions each, starting
+ * at the end offsets in starts, in step. Each lane is started with the CRC of the
+ * window before its first end, so the lanes do not depend on each other. The
+ * matches of each lane go to their own list, which the caller joins in order.
+ * It has no target attribute of its own, so that the software instance is plain
+ * x86; scanLanesHardware() inlines the other one into SSE4.2 code.
+ */
+template <bool kHardware>
+__attribute__((always_inline))
+static inline void scanLanes(const uint8_t* data, size_t window, const uint32_t* out, uint32_t finish, uint32_t mask,
+        const size_t* starts, size_t count, std::vector<size_t>* matches) {
+    uint32_t crc[kScanLanes];
+    for (size_t l = 0; l < kScanLanes; ++l) {
+        crc[l] = crc32c(0, data + starts[l] - window, window);
+        if (((crc[l] ^ finish) & mask) == 0) {
+            matches[l].push_back(starts[l]);
+        }
+    }
+    for (size_t k = 1; k < count; ++k) {
+        for (size_t l = 0; l < kScanLanes; ++l) {
+            size_t end = starts[l] + k;
+            if (kHardware) {
+                crc[l] = rollHardware(crc[l], out, data[end - 1 - window], data[end - 1]);
+            } else {
+                crc[l] = rollSoftware(crc[l], out, data[end - 1 - window], data[end - 1]);
+            }
+            if (unlikely(((crc[l] ^ finish) & mask) == 0)) {
+                matches[l].push_back(end);
+            }
+        }
+    }
+}
+
+CRC32C_TARGET_SSE42
+static void scanLanesHardware(const uint8_t* data, size_t window, const uint32_t* out, uint32_t finish, uint32_t mask,
+        const size_t* starts, size_t count, std::vector<size_t>* matches) {
+    scanLanes<true>(data, window, out, finish, mask, starts, count, matches);
+}
+
+static void scanLanesSoftware(const uint8_t* data, size_t window, const uint32_t* out, uint32_t finish, uint32_t mask,
+        const size_t* starts, size_t count, std::vector<size_t>* matches) {
+    scanLanes<false>(data, window, out, finish, mask, starts, count, matches);
+}
+
+void RollingCRC32C::scan(const void* data, size_t length, uint32_t mask, std::vector<size_t>* ends) const {
+    if (length < window_) {
+        return;
+    }
+    const uint8_t* bytes = (const uint8_t*) data;
+    size_t first = window_;
+    size_t positions = length - window_ + 1;
+
+    size_t perLane = positions / kScanLanes;
+    if (perLane >= kScanMinLane) {
+        size_t starts[kScanLanes];
+        for (size_t l = 0; l < kScanLanes; ++l) {
+            starts[l] = first + l * perLane;
+        }
+        std::vector<size_t> matches[kScanLanes];
+        if (hasHardware_) {
+            scanLanesHardware(bytes, window_, out_, finish_, mask, starts, perLane, matches);
+        } else {
+            scanLanesSoftware(bytes, window_, out_, finish_, mask, starts, perLane, matches);
+        }
+        for (size_t l = 0; l < kScanLanes; ++l) {
+            ends->insert(ends->end(), matches[l].begin(), matches[l].end());
+        }
+        first += kScanLanes * perLane;
+        positions -= kScanLanes * perLane;
+        if (positions == 0) {
+            return;
+        }
+    }
+
+    // What the lanes left over, one byte after the other
+    RollingCRC32C rolling(*this);
+    rolling.start(bytes + first - window_);
+    for (size_t end = first; ; ) {
+        if ((rolling.value() & mask) == 0) {
+            ends->push_back(end);
+        }
+        if (++end > length) {
+            break;
+        }
+        rolling.roll(bytes[end - 1 - window_], bytes[end - 1]);
+    }
+}
+
+}  // namespace logging
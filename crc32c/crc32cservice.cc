@@ -0,0 +1,247 @@
+#include "logging/crc32cservice.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <x86intrin.h>
+
+namespace logging {
+
+// A worker takes at most this many items from a ring before it looks at the next
+static const size_t kMaxBatch = 64;
+
+// Empty passes over its rings before a worker goes to sleep
+static const int kIdleSpins = 1000;
+
+struct CRC32CServiceItem {
+    const void* data;
+    size_t length;
+    CRC32CCallback callback;
+    void* context;
+};
+
+// The producer and the worker each write their own cache line, and keep a copy of
+// the other side's position so they only read the other line when it may have moved
+struct CRC32CServiceRing {
+    alignas(64) std::atomic<size_t> head;  // next item the producer writes
+    size_t tailCache;
+    alignas(64) std::atomic<size_t> tail;  // next item the worker reads
+    size_t worker;
+    size_t mask;
+    std::vector<CRC32CServiceItem> items;
+
+    CRC32CServiceRing(size_t size, size_t worker) : head(0), tailCache(0), tail(0), worker(worker),
+            mask(size - 1), items(size) {
+    }
+};
+
+// sleeping is set by the worker before it blocks on wakeup and cleared by the
+// first producer that sees it, so producers only lock while the worker sleeps
+struct CRC32CServiceWorker {
+    alignas(64) std::atomic<bool> sleeping;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+
+    CRC32CServiceWorker() : sleeping(false) {
+    }
+};
+
+// The items of one pass over a worker's rings, kept between passes so the
+// vectors are allocated once
+struct CRC32CServiceBatch {
+    std::vector<const CRC32CServiceItem*> items;
+    std::vector<size_t> counts;  // items taken from each ring
+    std::vector<uint32_t> crcs;
+    std::vector<const void*> small;
+    std::vector<size_t> smallLengths;
+    std::vector<size_t> smallItems;
+    std::vector<uint32_t> smallCrcs;
+};
+
+CRC32CService::CRC32CService(size_t producers, const std::vector<int>& cpus, size_t ringSize)
+        : crcfn_(detectBestCRC32C()), stop_(false) {
+    hasHardware_ = (crcfn_ != crc32cBraided);
+    size_t size = 1;
+    while (size < ringSize) {
+        size *= 2;
+    }
+    std::vector<int> workerCpus(cpus);
+    if (workerCpus.empty()) {
+        workerCpus.push_back(-1);
+    }
+    for (size_t i = 0; i < producers; ++i) {
+        rings_.push_back(new CRC32CServiceRing(size, i % workerCpus.size()));
+    }
+    for (size_t i = 0; i < workerCpus.size(); ++i) {
+        workerStates_.push_back(new CRC32CServiceWorker());
+    }
+    for (size_t i = 0; i < workerCpus.size(); ++i) {
+        workers_.push_back(std::thread(&CRC32CService::work, this, i, workerCpus[i]));
+    }
+}
+
+CRC32CService::~CRC32CService() {
+    stop_.store(true, std::memory_order_release);
+    // Pairs with the fence in waitForWork(): a worker either sees stop_ or is
+    // woken here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < workerStates_.size(); ++i) {
+        wake(workerStates_[i]);
+    }
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].join();
+    }
+    for (size_t i = 0; i < rings_.size(); ++i) {
+        delete rings_[i];
+    }
+    for (size_t i = 0; i < workerStates_.size(); ++i) {
+        delete workerStates_[i];
+    }
+}
+
+bool CRC32CService::submit(size_t producer, const void* data, size_t length, CRC32CCallback callback,
+        void* context) {
+    CRC32CServiceRing* ring = rings_[producer];
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tailCache > ring->mask) {
+        ring->tailCache = ring->tail.load(std::memory_order_acquire);
+        if (head - ring->tailCache > ring->mask) {
+            return false;
+        }
+    }
+    CRC32CServiceItem item = { data, length, callback, context };
+    ring->items[head & ring->mask] = item;
+    ring->head.store(head + 1, std::memory_order_release);
+    // Pairs with the fence in waitForWork(): either the worker sees the new head
+    // before it sleeps, or this sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    CRC32CServiceWorker* state = workerStates_[ring->worker];
+    if (state->sleeping.load(std::memory_order_relaxed)) {
+        wake(state);
+    }
+    return true;
+}
+
+void CRC32CService::wake(CRC32CServiceWorker* state) {
+    // Only the producer that clears the flag notifies. Taking the mutex makes sure
+    // the worker is either waiting or has not yet checked the flag.
+    if (state->sleeping.exchange(false, std::memory_order_acq_rel)) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->wakeup.notify_one();
+    }
+}
+
+void CRC32CService::waitForWork(CRC32CServiceWorker* state, const std::vector<CRC32CServiceRing*>& rings) {
+    state->sleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // A producer that submitted before the fence may not have seen the flag
+    bool pending = stop_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < rings.size() && !pending; ++i) {
+        pending = rings[i]->head.load(std::memory_order_relaxed) != rings[i]->tail.load(std::memory_order_relaxed);
+    }
+    if (pending) {
+        state->sleeping.store(false, std::memory_order_relaxed);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (state->sleeping.load(std::memory_order_acquire)) {
+        state->wakeup.wait(lock);
+    }
+}
+
+size_t CRC32CService::drain(const std::vector<CRC32CServiceRing*>& rings, CRC32CServiceBatch* batch) {
+    batch->items.clear();
+    batch->counts.clear();
+    for (size_t r = 0; r < rings.size(); ++r) {
+        CRC32CServiceRing* ring = rings[r];
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t count = ring->head.load(std::memory_order_acquire) - tail;
+        if (count > kMaxBatch) {
+            count = kMaxBatch;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            batch->items.push_back(&ring->items[(tail + i) & ring->mask]);
+        }
+        batch->counts.push_back(count);
+    }
+    size_t total = batch->items.size();
+    if (total == 0) {
+        return 0;
+    }
+
+    // Short buffers from all the rings are gathered for crc32c_buffers(), the rest
+    // hashed one by one; the callbacks then run in ring order
+    batch->crcs.resize(total);
+    batch->small.clear();
+    batch->smallLengths.clear();
+    batch->smallItems.clear();
+    for (size_t i = 0; i < total; ++i) {
+        const CRC32CServiceItem& item = *batch->items[i];
+        if (hasHardware_ && item.length <= kSmallLength) {
+            batch->small.push_back(item.data);
+            batch->smallLengths.push_back(item.length);
+            batch->smallItems.push_back(i);
+        } else {
+            batch->crcs[i] = crc32cFinish(crcfn_(crc32cInit(), item.data, item.length));
+        }
+    }
+    size_t numSmall = batch->small.size();
+    if (numSmall > 0) {
+        batch->smallCrcs.resize(numSmall);
+        crc32c_buffers(&batch->small[0], &batch->smallLengths[0], numSmall, &batch->smallCrcs[0]);
+        for (size_t i = 0; i < numSmall; ++i) {
+            batch->crcs[batch->smallItems[i]] = batch->smallCrcs[i];
+        }
+    }
+    size_t next = 0;
+    for (size_t r = 0; r < rings.size(); ++r) {
+        size_t count = batch->counts[r];
+        for (size_t i = 0; i < count; ++i, ++next) {
+            batch->items[next]->callback(batch->items[next]->context, batch->crcs[next]);
+        }
+        if (count > 0) {
+            // Only this worker writes tail
+            size_t tail = rings[r]->tail.load(std::memory_order_relaxed);
+            rings[r]->tail.store(tail + count, std::memory_order_release);
+        }
+    }
+    return total;
+}
+
+void CRC32CService::work(size_t worker, int cpu) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    }
+    std::vector<CRC32CServiceRing*> rings;
+    for (size_t i = 0; i < rings_.size(); ++i) {
+        if (rings_[i]->worker == worker) {
+            rings.push_back(rings_[i]);
+        }
+    }
+    CRC32CServiceBatch batch;
+    int idle = 0;
+    while (true) {
+        // Items submitted before the destructor was called are in the rings by
+        // the time it is seen, so an empty pass after it means there are none left
+        bool stopping = stop_.load(std::memory_order_acquire);
+        if (drain(rings, &batch) != 0) {
+            idle = 0;
+            continue;
+        }
+        if (stopping) {
+            break;
+        }
+        if (++idle < kIdleSpins) {
+            _mm_pause();
+        } else {
+            waitForWork(workerStates_[worker], rings);
+            idle = 0;
+        }
+    }
+}
+
+}  // namespace logging
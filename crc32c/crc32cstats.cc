@@ -0,0 +1,165 @@
+#include "logging/crc32cstats.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace logging {
+
+// Counters of one thread. Only the owner writes them, so an increment is a relaxed
+// load and store rather than a locked add; the atomics only keep snapshots from
+// reading torn values.
+struct ThreadStats {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> lengths[kCRC32CStatsBuckets];
+
+    ThreadStats();
+    ~ThreadStats();
+};
+
+// Threads with counters, and the sums of those that have exited
+struct StatsRegistry {
+    std::mutex mutex;
+    std::vector<ThreadStats*> threads;
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t lengths[kCRC32CStatsBuckets];
+
+    StatsRegistry() : calls(0), bytes(0) {
+        memset(lengths, 0, sizeof(lengths));
+    }
+};
+
+static StatsRegistry& statsRegistry() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+ThreadStats::ThreadStats() : calls(0), bytes(0) {
+    for (size_t i = 0; i < kCRC32CStatsBuckets; ++i) {
+        lengths[i].store(0, std::memory_order_relaxed);
+    }
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.calls += calls.load(std::memory_order_relaxed);
+    registry.bytes += bytes.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kCRC32CStatsBuckets; ++i) {
+        registry.lengths[i] += lengths[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < registry.threads.size(); ++i) {
+        if (registry.threads[i] == this) {
+            registry.threads[i] = registry.threads.back();
+            registry.threads.pop_back();
+            break;
+        }
+    }
+}
+
+static thread_local ThreadStats threadStats;
+
+static inline void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline size_t lengthBucket(size_t length) {
+    return length == 0 ? 0 : 64 - __builtin_clzll((unsigned long long) length);
+}
+
+static std::atomic<bool> statsEnabled(false);
+static std::atomic<CRC32CFunctionPtr> statsKernel(NULL);
+
+static uint32_t crc32cCounted(uint32_t crc, const void* data, size_t length) {
+    ThreadStats& stats = threadStats;
+    bump(stats.calls, 1);
+    bump(stats.bytes, length);
+    bump(stats.lengths[lengthBucket(length)], 1);
+    return statsKernel.load(std::memory_order_relaxed)(crc, data, length);
+}
+
+static CRC32CFunctionPtr statsKernelOrDetect() {
+    CRC32CFunctionPtr kernel = statsKernel.load();
+    if (kernel == NULL) {
+        kernel = detectBestCRC32C();
+        statsKernel.store(kernel);
+    }
+    return kernel;
+}
+
+CRC32CFunctionPtr crc32cStatsSelect(CRC32CFunctionPtr best) {
+    statsKernel.store(best);
+    // CRC32C_STATS=1 counts from the first call, e.g. to see the lengths a
+    // service hashes without rebuilding it
+    const char* requested = getenv("CRC32C_STATS");
+    if (requested != NULL && strcmp(requested, "1") == 0) {
+        statsEnabled.store(true);
+    }
+    return statsEnabled.load() ? crc32cCounted : best;
+}
+
+void crc32cStatsEnable(bool enable) {
+    // The kernel goes in before the wrapper can be called
+    CRC32CFunctionPtr kernel = statsKernelOrDetect();
+    statsEnabled.store(enable);
+    crc32c = enable ? crc32cCounted : kernel;
+}
+
+bool crc32cStatsEnabled() {
+    return statsEnabled.load();
+}
+
+static const struct {
+    CRC32CFunctionPtr kernel;
+    const char* name;
+} kKernelNames[] = {
+    { crc32cSarwate, "crc32cSarwate" },
+    { crc32cSlicingBy4, "crc32cSlicingBy4" },
+    { crc32cSlicingBy8, "crc32cSlicingBy8" },
+    { crc32cBraided, "crc32cBraided" },
+    { crc32cHardware32, "crc32cHardware32" },
+    { crc32cHardware64, "crc32cHardware64" },
+    { crc32cAdler, "crc32cAdler" },
+    { crc32cIntelC, "crc32cIntelC" },
+    { crc32c_hw, "crc32c_hw" },
+    { crc32c_vpclmul_avx2, "crc32c_vpclmul_avx2" },
+};
+
+static const char* kernelName(CRC32CFunctionPtr kernel) {
+    for (size_t i = 0; i < sizeof(kKernelNames)/sizeof(*kKernelNames); ++i) {
+        if (kKernelNames[i].kernel == kernel) {
+            return kKernelNames[i].name;
+        }
+    }
+    return "unknown";
+}
+
+CRC32CStats crc32cStatsSnapshot() {
+    CRC32CStats snapshot;
+    snapshot.kernel = statsKernelOrDetect();
+    snapshot.kernelName = kernelName(snapshot.kernel);
+
+    StatsRegistry& registry = statsRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    snapshot.calls = registry.calls;
+    snapshot.bytes = registry.bytes;
+    memcpy(snapshot.lengths, registry.lengths, sizeof(snapshot.lengths));
+    for (size_t t = 0; t < registry.threads.size(); ++t) {
+        const ThreadStats* stats = registry.threads[t];
+        snapshot.calls += stats->calls.load(std::memory_order_relaxed);
+        snapshot.bytes += stats->bytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kCRC32CStatsBuckets; ++i) {
+            snapshot.lengths[i] += stats->lengths[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+}  // namespace logging
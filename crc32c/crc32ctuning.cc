@@ -0,0 +1,161 @@
+#include "logging/crc32ctuning.h"
+
+#include <cpuid.h>
+#include <cstdlib>
+#include <cstring>
+
+namespace logging {
+
+enum {
+    kNehalem,
+    kWestmere,
+    kSandyBridge,
+    kIvyBridge,
+    kHaswell,
+    kBroadwell,
+    kSkylake,
+    kIceLake,
+    kAlderLake,
+    kSapphireRapids,
+    kSilvermont,
+    kGoldmont,
+    kZen,
+    kZen2,
+    kZen3,
+    kZen4
+};
+
+// The Nehalem row holds the values the kernels were originally written with.
+// Nehalem through Ivy Bridge run crc32 with a latency of three cycles at one per
+// cycle and have a slow pclmulqdq, so the recombine is amortized over long
+// blocks. From Haswell on pclmulqdq gets cheaper and the crossovers come down.
+// The Atom cores have a very slow pclmulqdq and want the longest blocks. Zen
+// matches the crc32 latency of the Intel cores but has a lower pclmulqdq
+// latency, so it recombines more often and switches to triplets earlier.
+// The prefetch distance grows with the memory latency and the number of misses
+// a core keeps in flight. On Sapphire Rapids 1024 bytes gained almost nothing
+// on data from DRAM and 3072 bytes about 1.4x.
+// These are starting points; verify changes with crc32cbench on the part.
+// clang-format off
+static const CRC32CTuning kTunings[] = {
+    // name               adlerLong adlerShort hwMaxBlock intelMaxBlock intelSmallSize pclSmallSize prefetchDistance
+    { "Nehalem",              8192,       256,       128,          128,           216,         200,             1024 },
+    { "Westmere",             8192,       256,       128,          128,           216,         200,             1024 },
+    { "Sandy Bridge",         8192,       256,       128,          128,           216,         200,             1024 },
+    { "Ivy Bridge",           8192,       256,       128,          128,           216,         200,             1024 },
+    { "Haswell",              8192,       256,       128,          128,           192,         192,             1536 },
+    { "Broadwell",            8192,       256,       128,          128,           192,         192,             1536 },
+    { "Skylake",              8192,       256,       128,          128,           168,         168,             2048 },
+    { "Ice Lake",             8192,       256,       128,          128,           168,         168,             2048 },
+    { "Alder Lake",           8192,       256,       128,          128,           168,         168,             2048 },
+    { "Sapphire Rapids",      8192,       256,       128,          128,           168,         168,             3072 },
+    { "Silvermont",          16384,       512,       128,          128,           216,         255,              512 },
+    { "Goldmont",            16384,       512,       128,          128,           216,         240,              768 },
+    { "Zen",                  4096,       256,        96,           96,           168,         168,             1024 },
+    { "Zen 2",                4096,       256,        96,           96,           144,         144,             1536 },
+    { "Zen 3",                4096,       128,        64,           64,           120,         120,             2048 },
+    { "Zen 4",                4096,       128,        64,           64,           120,         120,             2048 },
+};
+// clang-format on
+
+static const CRC32CTuning& intelTuning(unsigned family, unsigned model) {
+    if (family != 6) {
+        return kTunings[kNehalem];
+    }
+    switch (model) {
+        case 0x1a: case 0x1e: case 0x1f: case 0x2e:
+            return kTunings[kNehalem];
+        case 0x25: case 0x2c: case 0x2f:
+            return kTunings[kWestmere];
+        case 0x2a: case 0x2d:
+            return kTunings[kSandyBridge];
+        case 0x3a: case 0x3e:
+            return kTunings[kIvyBridge];
+        case 0x3c: case 0x3f: case 0x45: case 0x46:
+            return kTunings[kHaswell];
+        case 0x3d: case 0x47: case 0x4f: case 0x56:
+            return kTunings[kBroadwell];
+        // Skylake, Kaby Lake, Coffee Lake, Comet Lake and the Skylake servers
+        case 0x4e: case 0x5e: case 0x55: case 0x8e: case 0x9e: case 0xa5: case 0xa6:
+            return kTunings[kSkylake];
+        // Ice Lake, Tiger Lake and Rocket Lake
+        case 0x6a: case 0x6c: case 0x7d: case 0x7e: case 0x8c: case 0x8d: case 0xa7:
+            return kTunings[kIceLake];
+        // Alder Lake, Raptor Lake and Meteor Lake
+        case 0x97: case 0x9a: case 0xb7: case 0xba: case 0xbf: case 0xaa: case 0xac:
+            return kTunings[kAlderLake];
+        // Sapphire Rapids and Emerald Rapids
+        case 0x8f: case 0xcf:
+            return kTunings[kSapphireRapids];
+        // Silvermont and Airmont (Edison, NUC E3815)
+        case 0x37: case 0x4a: case 0x4c: case 0x4d: case 0x5a: case 0x5d:
+            return kTunings[kSilvermont];
+        // Goldmont, Goldmont Plus and Tremont
+        case 0x5c: case 0x5f: case 0x7a: case 0x86: case 0x96: case 0x9c:
+            return kTunings[kGoldmont];
+        default:
+            return kTunings[kNehalem];
+    }
+}
+
+static const CRC32CTuning& amdTuning(unsigned family, unsigned model) {
+    switch (family) {
+        case 0x17:
+            return (model < 0x30) ? kTunings[kZen] : kTunings[kZen2];
+        case 0x18:  // Hygon Dhyana is a Zen core
+            return kTunings[kZen];
+        case 0x19:
+            if ((model >= 0x10 && model <= 0x1f) || (model >= 0x60 && model <= 0x7f) ||
+                    (model >= 0xa0 && model <= 0xaf)) {
+                return kTunings[kZen4];
+            }
+            return kTunings[kZen3];
+        default:
+            // Everything after Zen 4 uses its values; everything before Zen the defaults
+            return (family > 0x19) ? kTunings[kZen4] : kTunings[kNehalem];
+    }
+}
+
+const CRC32CTuning& crc32cTuningFor(bool amd, unsigned family, unsigned model) {
+    return amd ? amdTuning(family, model) : intelTuning(family, model);
+}
+
+static const CRC32CTuning& detectTuning() {
+    unsigned int eax, ebx, ecx, edx;
+
+    // CRC32C_TUNING="Zen 3" forces a row, e.g. to compare rows with crc32cbench
+    const char* forced = getenv("CRC32C_TUNING");
+    if (forced != NULL) {
+        for (size_t i = 0; i < sizeof(kTunings)/sizeof(*kTunings); ++i) {
+            if (strcmp(forced, kTunings[i].name) == 0) {
+                return kTunings[i];
+            }
+        }
+    }
+
+    if (__get_cpuid_max(0, NULL) < 1) {
+        return kTunings[kNehalem];
+    }
+    __cpuid(0, eax, ebx, ecx, edx);
+    // "AuthenticAMD" or "HygonGenuine"
+    bool amd = (ebx == signature_AMD_ebx && edx == signature_AMD_edx && ecx == signature_AMD_ecx) ||
+               (ebx == 0x6f677948 && edx == 0x6e65476e && ecx == 0x656e6975);
+
+    __cpuid(1, eax, ebx, ecx, edx);
+    unsigned family = (eax >> 8) & 0x0f;
+    unsigned model = (eax >> 4) & 0x0f;
+    if (family == 0x0f) {
+        family += (eax >> 20) & 0xff;
+    }
+    if (family == 0x06 || family >= 0x0f) {
+        model |= ((eax >> 16) & 0x0f) << 4;
+    }
+    return crc32cTuningFor(amd, family, model);
+}
+
+const CRC32CTuning& crc32cTuning() {
+    static const CRC32CTuning& tuning = detectTuning();
+    return tuning;
+}
+
+}  // namespace logging
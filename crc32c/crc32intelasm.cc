@@ -16,14 +16,24 @@
  */
 
 #include "logging/crc32c.h"
+#include "logging/crc32ctuning.h"
 
 namespace logging
 {
-extern "C" unsigned int crc_pcl ( unsigned char * buffer, int len, unsigned int crc_init );
+extern "C" unsigned int crc_pcl ( unsigned char * buffer, size_t len, unsigned int crc_init );
+extern "C" uint64_t crc_pcl_small_size;
+
+/* Hand the tuned SMALL_SIZE to crc_pcl; the "by-1" code handles at most 255 bytes */
+static void crc_pcl_init_tuning ( void ) __attribute__ ( ( constructor ) );
+static void crc_pcl_init_tuning ( void )
+{
+        size_t small_size = crc32cTuning().pclSmallSize;
+        crc_pcl_small_size = ( small_size > 255 ) ? 255 : small_size;
+}
 
 uint32_t crc32cIntelAsm ( uint32_t crc, const void *buf, size_t len )
 {
-        return ( unsigned int ) crc_pcl ( ( unsigned char * ) buf, ( int ) len, ( unsigned int ) crc );
+        return ( unsigned int ) crc_pcl ( ( unsigned char * ) buf, len, ( unsigned int ) crc );
 }
 }
 // kate: indent-mode cstyle; indent-width 8; replace-tabs on; 
@@ -41,35 +41,37 @@
 */
 
 #include "logging/crc32c.h"
+#include "logging/crc32cload.h"
 #include "logging/crc32intelc.h"
+#include "logging/crc32ctuning.h"
 #include <x86intrin.h>
 
 namespace logging
 {
 
-extern __v2di K[];
-
 /* Compute CRC-32C using the Intel hardware instruction. */
+CRC32C_TARGET_HW
 uint32_t crc32cIntelC ( uint32_t crc, const void *buf, size_t len )
 {
         const unsigned char *next = ( const unsigned char * ) buf;
-        unsigned long count;
+        size_t count;
         CRC_NATIVE crc0, crc1, crc2;
         crc0 = crc;
 
         if ( len >= 8 ) {
-                // if len > 216 then align and use triplets
-                if ( len > 216 ) {
+                const CRC32CTuning &tuning = crc32cTuning();
+                // if len > 216 (or the tuned crossover) then align and use triplets
+                if ( len > tuning.intelSmallSize ) {
                         {
                                 uint32_t crc32bit = crc0;                                       // create this block actually prevent 2 asignments
-                                unsigned long align = ( 8 - ( uintptr_t ) next ) % 8;           // byte to boundary
+                                size_t align = ( 8 - ( uintptr_t ) next ) % 8;           // byte to boundary
                                 len -= align;
                                 if ( align & 0x04 ) {
-                                        crc32bit = __builtin_ia32_crc32si ( crc32bit, * ( uint32_t* ) next );
+                                        crc32bit = __builtin_ia32_crc32si ( crc32bit, crc32c_load_u32 ( next ) );
                                         next += sizeof(uint32_t);
                                 };
                                 if ( align & 0x02 ) {
-                                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) next );
+                                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, crc32c_load_u16 ( next ) );
                                         next += sizeof(uint16_t);
                                 };
 
@@ -80,14 +82,15 @@ uint32_t crc32cIntelC ( uint32_t crc, const void *buf, size_t len )
                                 crc0 = crc32bit;
                         };
 
-                        // use Duff's device, a for() loop inside a switch() statement. This is Legal
+                        // use a variant of Duff's device, jumping into the unrolled switch() once per block
                         // needs to execute at least once, round len down to nearast triplet multiple
                         count = len / 24;			// number of triplets
                         len %= 24;				// bytes remaining
-                        unsigned long n = count / 128;		// #blocks = first block + full blocks
-                        unsigned long block_size = count % 128;
+                        const size_t max_block_size = tuning.intelMaxBlock;      // 128 or less
+                        size_t n = count / max_block_size;		// #blocks = first block + full blocks
+                        size_t block_size = count % max_block_size;
                         if ( block_size == 0 ) {
-                                block_size = 128;
+                                block_size = max_block_size;
                         } else {
                                 n++;
                         };
@@ -96,9 +99,9 @@ uint32_t crc32cIntelC ( uint32_t crc, const void *buf, size_t len )
                         const uint64_t *next2 = next1 + block_size;
 
                         crc1 = crc2 = 0;
-                        switch ( block_size ) {
-                        case 128:
-                                do {
+                        do {
+                                switch ( block_size ) {         // full blocks below 128 also enter part way
+                                case 128:
                                         CRCtriplet ( crc, next, -128 );	// jumps here for a full block of len 128
                                 case 127:
                                         CRCtriplet ( crc, next, -127 );	// jumps here or below for the first block smaller
@@ -354,18 +357,18 @@ uint32_t crc32cIntelC ( uint32_t crc, const void *buf, size_t len )
                                         CRCtriplet ( crc, next, -2 );
                                 case 1:
                                         CRCduplet ( crc, next, -1 );		        // the final triplet is actually only 2
-                                        CombineCRC();
+                                        crc0 = CombineCRC ( block_size, crc0, crc1, crc2, next2 );
                                         if ( --n > 0 ) {
                                                 crc1 = crc2 = 0;
-                                                block_size = 128;
-                                                next0 = next2 + 128;			// points to the first byte of the next block
-                                                next1 = next0 + 128;			// from here on all blocks are 128 long
-                                                next2 = next1 + 128;
+                                                block_size = max_block_size;
+                                                next0 = next2 + max_block_size;	// points to the first byte of the next block
+                                                next1 = next0 + max_block_size;	// from here on all blocks are max_block_size long
+                                                next2 = next1 + max_block_size;
                                         };
                                 case 0:
                                         ;
-                                } while ( n > 0 );
-                        };
+                                };
+                        } while ( n > 0 );
                         next = ( const unsigned char* ) next2;
                 };
                 unsigned count = len / 8;                                               // 216 of less bytes is 27 or less singlets
@@ -436,11 +439,11 @@ uint32_t crc32cIntelC ( uint32_t crc, const void *buf, size_t len )
                 // less than 8 bytes remain
                 /* compute the crc for up to seven trailing bytes */
                 if ( len & 0x04 ) {
-                        crc32bit = __builtin_ia32_crc32si ( crc32bit, * ( uint32_t* ) next );
+                        crc32bit = __builtin_ia32_crc32si ( crc32bit, crc32c_load_u32 ( next ) );
                         next += 4;
                 };
                 if ( len & 0x02 ) {
-                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, * ( uint16_t* ) next );
+                        crc32bit = __builtin_ia32_crc32hi ( crc32bit, crc32c_load_u16 ( next ) );
                         next += 2;
                 };
 
@@ -80,7 +80,8 @@
 
 ; Define threshold where buffers are considered "small" and routed to more
 ; efficient "by-1" code. This "by-1" code only handles up to 255 bytes, so
-; SMALL_SIZE can be no larger than 255.
+; SMALL_SIZE can be no larger than 255. SMALL_SIZE is only the default of
+; crc_pcl_small_size, which the C wrapper sets from the CPU tuning table.
 %define SMALL_SIZE 200
 
 %if (SMALL_SIZE > 255)
@@ -88,7 +89,8 @@
 % error ; needed because '%error' actually generates only a warning
 %endif
 
-; unsigned int crc_pcl(unsigned char * buffer, int len, unsigned int crc_init);
+; unsigned int crc_pcl(unsigned char * buffer, size_t len, unsigned int crc_init);
+; len is used as a full 64-bit register up to the point where it is below 128*24
 
 global  crc_pcl:function
 crc_pcl:
@@ -150,7 +152,7 @@ proc_block:
         jae     full_block
 
 continue_block:
-        cmp     len, SMALL_SIZE
+        cmp     len, [crc_pcl_small_size wrt rip]
         jb      small
 
         ;; len < 128*24
@@ -333,11 +335,19 @@ jump_table:
 %endrep
 
 
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+; Tuned small size threshold, at most 255
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+section .data
+align 8
+global crc_pcl_small_size:data hidden
+crc_pcl_small_size:
+        dq      SMALL_SIZE
+
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 ; PCLMULQDQ tables
 ; Table is 128 entries x 2 quad words each
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-section .data
 align 64
 K_table:
         dq 0x14cd00bd6, 0x105ec76f0
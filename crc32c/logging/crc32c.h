@@ -8,8 +8,18 @@
 #include <cstddef>
 #include <stdint.h>
 
-#ifndef __SSE4_2__
-#define __SSE4_2__  1
+// The hardware kernels are compiled for SSE4.2 and PCLMULQDQ with this attribute
+// instead of -msse4.2 -mpclmul on the command line. Everything else stays baseline
+// x86, so one binary runs on any host and only calls a kernel after the CPU has
+// been checked.
+// CRC32C_TARGET_SSE42 is for kernels that only use the crc32 instruction and so
+// also run on SSE4.2 CPUs without PCLMULQDQ, such as Nehalem.
+#if defined(__GNUC__) || defined(__clang__)
+#define CRC32C_TARGET_HW    __attribute__((target("sse4.2,pclmul")))
+#define CRC32C_TARGET_SSE42 __attribute__((target("sse4.2")))
+#else
+#define CRC32C_TARGET_HW
+#define CRC32C_TARGET_SSE42
 #endif
 
 #if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
@@ -61,9 +71,21 @@ static inline uint32_t crc32cFinish(uint32_t crc) {
     return ~crc;
 }
 
+/** Returns the CRC32-C of A followed by B, given crc1 of A, crc2 of B and the
+length of B in bytes. Both CRCs are final values, as returned by crc32cFinish().
+Costs O(log length2) GF(2) multiplications and does not touch the data. */
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, size_t length2);
+
+/** Returns the CRC32-C of the first len_full - tail_len bytes of a buffer, given
+its final CRC crc_full, its length len_full and its last tail_len bytes. Only the
+tail is read, e.g. to drop a torn record from the end of a log without
+rechecksumming the log. CRCs are final values, like for crc32cCombine(). */
+uint32_t crc32c_truncate(uint32_t crc_full, size_t len_full, const void* tail_bytes, size_t tail_len);
+
 uint32_t crc32cSarwate(uint32_t crc, const void* data, size_t length);
 uint32_t crc32cSlicingBy4(uint32_t crc, const void* data, size_t length);
 uint32_t crc32cSlicingBy8(uint32_t crc, const void* data, size_t length);
+uint32_t crc32cBraided(uint32_t crc, const void* data, size_t length);
 uint32_t crc32cHardware32(uint32_t crc, const void* data, size_t length);
 uint32_t crc32cHardware64(uint32_t crc, const void* data, size_t length);
 uint32_t crc32cAdler(uint32_t crc, const void* data, size_t length);
@@ -75,6 +97,54 @@ uint32_t crc32c_hw_x64(uint32_t crc, const void * data, size_t length);
 uint32_t crc32c_hw_u32(uint32_t crc, const void * data, size_t length);
 uint32_t crc32c_hw_u64(uint32_t crc, const void * data, size_t length);
 uint32_t crc32c_hw(uint32_t crc, const void * data, size_t length);
+uint32_t crc32c_hw_4way(uint32_t crc, const void * data, size_t length);
+uint32_t crc32c_hw_6way(uint32_t crc, const void * data, size_t length);
+
+/** crc32c_hw with software prefetch ahead of each of its three streams. For data
+that is not in cache, e.g. just written by DMA; detectBestCRC32C() does not pick it. */
+uint32_t crc32c_hw_prefetch(uint32_t crc, const void * data, size_t length);
+
+/** crc32c_hw_prefetch with the three streams a third of a 2 MiB page long, so they
+stay inside one huge page. For buffers of many megabytes backed by huge pages, e.g.
+from crc32cAllocHuge(). */
+uint32_t crc32c_hw_large(uint32_t crc, const void * data, size_t length);
+
+/** Checksums count pages of page_size bytes each, laid out one after the other
+from base, into out[0..count-1]. Each out[i] is a final value, the same as
+crc32cFinish(crc32c_hw(crc32cInit(), page, page_size)). Three pages are hashed at
+a time as three independent crc32 streams. Needs SSE4.2 and PCLMULQDQ like
+crc32c_hw. */
+void crc32c_pages(const void * base, size_t page_size, size_t count, uint32_t * out);
+
+/** crc32c_pages for count buffers of any lengths: out[i] is the final CRC32-C of
+lengths[i] bytes at data[i]. Three buffers at a time are hashed as three crc32
+streams over the length they have in common, for many short buffers that are
+each too short for the streams of crc32c_hw. Needs SSE4.2 only. */
+void crc32c_buffers(const void * const * data, const size_t * lengths, size_t count, uint32_t * out);
+
+/** Hashes length bytes from data once and saves the running CRC after each of the
+n offsets, which must be in increasing order and at most length: out[i] is
+crc32c_hw(crc, data, offsets[i]), not yet finished. Returns the running CRC after
+all length bytes. The three crc32q streams of crc32c_hw keep going across the
+offsets, so short records cost no more per byte than one long buffer. Needs SSE4.2
+and PCLMULQDQ like crc32c_hw. */
+uint32_t crc32c_checkpoints(uint32_t crc, const void * data, size_t length,
+                            const size_t * offsets, size_t n, uint32_t * out);
+
+/** Folds 128 bytes per iteration with 256-bit vpclmulqdq. Only call it when
+crc32cHasVPCLMULQDQ() returns true. */
+uint32_t crc32c_vpclmul_avx2(uint32_t crc, const void * data, size_t length);
+
+/** Returns true if the CPU has SSE4.2 and PCLMULQDQ, which the kernels that
+combine streams (crc32c_hw and its variants, crc32cIntelC, crc32c_pages,
+crc32c_checkpoints, crc32c_fixed) need. crc32cHardware32/64, crc32cAdler,
+crc32c_buffers and RollingCRC32C only need SSE4.2: they can run whenever
+detectBestCRC32C() does not return crc32cBraided. */
+bool crc32cHasPCLMULQDQ();
+
+/** Returns true if the CPU has AVX2 and VPCLMULQDQ and the OS saves the YMM
+registers, so crc32c_vpclmul_avx2 can run. */
+bool crc32cHasVPCLMULQDQ();
 
 }  // namespace logging
 #endif
@@ -0,0 +1,61 @@
+#ifndef LOGGING_CRC32CACCUMULATOR_H__
+#define LOGGING_CRC32CACCUMULATOR_H__
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+namespace logging {
+
+/** Joins the CRC32-Cs of the segments of an object that arrive in any order, e.g.
+the parts of a multipart upload, into the CRC32-C of the object, without the
+data. add() may be called from many threads at once and takes no lock: the CRC
+of each segment is moved back over everything up to the end of the segment, which
+makes it independent of the segments after it, and xored into one atomic word.
+value() moves the sum forward over the whole object. Each byte of the object must
+be in exactly one segment, so a part whose upload is retried must not be added
+again to the same accumulator: a duplicate is only caught when the segments then
+add up to more than the object, and one that is not leaves value() wrong. */
+class CRC32CAccumulator {
+public:
+    /** length is that of the whole object in bytes. */
+    explicit CRC32CAccumulator(size_t length);
+
+    size_t length() const {
+        return length_;
+    }
+
+    /** Adds the segment [offset, offset + length) with final CRC32-C crc, as
+    returned by crc32cFinish(). Returns true for the one call that completes the
+    object, after which value() is valid in that thread. A segment that ends past
+    the object, or would make the segments add up to more than it, is not added:
+    add() returns false and failed() becomes true. */
+    bool add(size_t offset, size_t length, uint32_t crc);
+
+    /** True once add() has rejected a segment. The object cannot be trusted to
+    complete with the right value after that. */
+    bool failed() const {
+        return failed_.load(std::memory_order_relaxed);
+    }
+
+    /** True once segments covering the whole object have been added, and from
+    the start for an object of length 0. */
+    bool complete() const {
+        return received_.load(std::memory_order_acquire) == length_;
+    }
+
+    /** Final CRC32-C of the object. Only valid once complete() is true. */
+    uint32_t value() const;
+
+private:
+    const size_t length_;
+    // Sum of crc * x^(-8 * (offset + length)) over the segments added so far
+    std::atomic<uint32_t> sum_;
+    // Bytes claimed by add() calls before their xor, and bytes whose xor is done
+    std::atomic<size_t> reserved_;
+    std::atomic<size_t> received_;
+    std::atomic<bool> failed_;
+};
+
+}  // namespace logging
+#endif
@@ -0,0 +1,74 @@
+#ifndef LOGGING_CRC32CDELTA_H__
+#define LOGGING_CRC32CDELTA_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace logging {
+
+/** One step of rebuilding the new data: copy length bytes from offset in the
+reference, or take length bytes from offset in CRC32CDelta::literals. */
+struct CRC32CDeltaOp {
+    enum Kind {
+        COPY,
+        LITERAL
+    };
+    Kind kind;
+    size_t offset;
+    size_t length;
+};
+
+/** The new data as copies from the reference and literal bytes. Adjacent copies
+are merged, so a long unchanged stretch is a single op. */
+struct CRC32CDelta {
+    std::vector<CRC32CDeltaOp> ops;
+    std::vector<char> literals;
+};
+
+/** rsync-style block matching against a reference that is in memory. The
+reference is cut into blocks of blockSize bytes whose CRC32-Cs go into an open
+addressing table of (crc, block) pairs. diff() rolls a RollingCRC32C over the new
+data and looks the window CRC up at every byte; a candidate block is confirmed
+with memcmp, so a delta never depends on CRCs not colliding. The reference must
+stay valid and unchanged while the index is used. */
+class CRC32CDeltaIndex {
+public:
+    /** blockSize must be at least 1. A last partial block of the reference is not
+    indexed, and neither is a block with the same bytes as an earlier one. */
+    CRC32CDeltaIndex(const void* reference, size_t length, size_t blockSize);
+
+    size_t blockSize() const {
+        return blockSize_;
+    }
+
+    /** Replaces delta with the ops that rebuild data from the reference. */
+    void diff(const void* data, size_t length, CRC32CDelta* delta) const;
+
+private:
+    static const uint32_t kEmpty = UINT32_MAX;
+
+    struct Slot {
+        uint32_t crc;
+        uint32_t block;
+    };
+
+    // Index of a block of the reference holding the blockSize bytes at data,
+    // trying hint first, or kEmpty
+    uint32_t find(uint32_t crc, const char* data, uint32_t hint) const;
+
+    const char* reference_;
+    size_t numBlocks_;
+    size_t blockSize_;
+    size_t mask_;
+    std::vector<Slot> slots_;
+    // One bit per value of the top bits of a CRC, set when some block has it
+    unsigned filterShift_;
+    std::vector<uint64_t> filter_;
+};
+
+/** Writes the data described by delta, built against reference, to out. */
+void crc32cDeltaApply(const void* reference, const CRC32CDelta& delta, std::vector<char>* out);
+
+}  // namespace logging
+#endif
@@ -0,0 +1,132 @@
+#ifndef LOGGING_CRC32CFIXED_H__
+#define LOGGING_CRC32CFIXED_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "crc32c.h"
+#include "crc32cload.h"
+
+namespace logging {
+
+/** Multipliers for combining three streams of B quadwords, for B = 1..128:
+entries 2 * (B - 1) and 2 * (B - 1) + 1 move the first and the second stream
+over the ones after it. Defined in crc32c_hw.cc. */
+extern const uint64_t crc32c_clmul_constants[256];
+
+// crc32c_fixed<N> splits a length into triplet blocks of at most this many
+// quadwords per stream, the length of the constants table
+static const size_t kFixedMaxBlock = 128;
+// Shorter than this per stream, a triplet block does not pay for its combine;
+// 8 quadwords is 192 bytes, close to the crossover of crc32cIntelC
+static const size_t kFixedMinBlock = 8;
+
+// Q quadwords with crc32q, unrolled by the compiler
+template <size_t Q>
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_fixed_words(uint32_t crc, const char* data) {
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+#pragma GCC unroll 128
+    for (size_t i = 0; i < Q; ++i) {
+        crc64 = _mm_crc32_u64(crc64, crc32c_load_u64(data + 8 * i));
+    }
+    return (uint32_t) crc64;
+#else
+#pragma GCC unroll 128
+    for (size_t i = 0; i < 2 * Q; ++i) {
+        crc = _mm_crc32_u32(crc, crc32c_load_u32(data + 4 * i));
+    }
+    return crc;
+#endif
+}
+
+// Three streams of B quadwords, joined like crc32c_combine_crc_u64 in crc32c_hw.cc
+template <size_t B>
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_fixed_triplet(uint32_t crc, const char* data) {
+    uint64_t crc0 = crc;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+#pragma GCC unroll 128
+    for (size_t i = 0; i < B - 1; ++i) {
+        crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(data + 8 * i));
+        crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(data + 8 * (B + i)));
+        crc2 = _mm_crc32_u64(crc2, crc32c_load_u64(data + 8 * (2 * B + i)));
+    }
+    crc0 = _mm_crc32_u64(crc0, crc32c_load_u64(data + 8 * (B - 1)));
+    crc1 = _mm_crc32_u64(crc1, crc32c_load_u64(data + 8 * (2 * B - 1)));
+
+    const __m128i multiplier = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&crc32c_clmul_constants[2 * (B - 1)]));
+    const __m128i result = _mm_xor_si128(_mm_clmulepi64_si128(_mm_cvtsi64_si128((int64_t) crc0), multiplier, 0x00),
+                                         _mm_clmulepi64_si128(_mm_cvtsi64_si128((int64_t) crc1), multiplier, 0x10));
+    uint64_t last = (uint64_t) _mm_cvtsi128_si64(result) ^ crc32c_load_u64(data + 8 * (3 * B - 1));
+    return (uint32_t) _mm_crc32_u64(crc2, last);
+}
+
+// The triplet block taken from the front of N bytes: as long as possible, up to
+// kFixedMaxBlock, or 0 to go by words
+template <size_t N>
+struct CRC32CFixedSplit {
+#ifdef __x86_64__
+    static const size_t kLongest = N / (3 * sizeof(uint64_t));
+#else
+    static const size_t kLongest = 0;
+#endif
+    static const size_t kBlock = (kLongest < kFixedMinBlock) ? 0 :
+                                 (kLongest > kFixedMaxBlock) ? kFixedMaxBlock : kLongest;
+};
+
+template <size_t N, size_t B = CRC32CFixedSplit<N>::kBlock>
+struct CRC32CFixed {
+    CRC32C_TARGET_HW
+    static inline uint32_t run(uint32_t crc, const char* data) {
+        crc = crc32c_fixed_triplet<B>(crc, data);
+        return CRC32CFixed<N - 3 * sizeof(uint64_t) * B>::run(crc, data + 3 * sizeof(uint64_t) * B);
+    }
+};
+
+// No triplet block left: whole quadwords, then the last 0..7 bytes, with the
+// length known there is no branch
+template <size_t N>
+struct CRC32CFixed<N, 0> {
+    CRC32C_TARGET_HW
+    static inline uint32_t run(uint32_t crc, const char* data) {
+        crc = crc32c_fixed_words<N / 8>(crc, data);
+        data += N & ~(size_t) 7;
+        if (N & 4) {
+            crc = _mm_crc32_u32(crc, crc32c_load_u32(data));
+            data += 4;
+        }
+        if (N & 2) {
+            crc = _mm_crc32_u16(crc, crc32c_load_u16(data));
+            data += 2;
+        }
+        if (N & 1) {
+            crc = _mm_crc32_u8(crc, (uint8_t) *data);
+        }
+        return crc;
+    }
+};
+
+/** crc32c of exactly N bytes, e.g. crc32c_fixed<512>(crc, sector). The length is
+split at compile time into triplet blocks with their combine constant, then
+quadwords, then the 0..7 byte tail, so there is no length logic at runtime. Needs
+SSE4.2 and PCLMULQDQ like crc32c_hw: only call it when crc32cHasPCLMULQDQ()
+returns true. GCC only inlines it into a caller compiled for the same target, so
+mark the caller CRC32C_TARGET_HW:
+
+    CRC32C_TARGET_HW uint32_t sectorCRC(const char* sector) {
+        return crc32cFinish(crc32c_fixed<512>(crc32cInit(), sector));
+    }
+
+From any other function it is an out-of-line call to a copy for N. */
+template <size_t N>
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_fixed(uint32_t crc, const void* data) {
+    return CRC32CFixed<N>::run(crc, (const char*) data);
+}
+
+}  // namespace logging
+#endif
@@ -0,0 +1,25 @@
+#ifndef LOGGING_CRC32CGF2_H__
+#define LOGGING_CRC32CGF2_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace logging {
+
+/** Multiplies two polynomials modulo the CRC-32C polynomial over GF(2). Both
+are in reversed bit order, like CRC values: bit 31 is the coefficient of x^0. */
+uint32_t crc32c_multiply(uint32_t a, uint32_t b);
+
+/** Returns x^n modulo the CRC-32C polynomial in reversed bit order. Shifting a
+CRC by n zero bits multiplies it by this value. */
+uint32_t crc32c_x_pow(size_t n);
+
+/** Returns x^-n modulo the CRC-32C polynomial in reversed bit order. Multiplying
+by this value undoes a shift by n zero bits. */
+uint32_t crc32c_x_pow_inverse(size_t n);
+
+/** Returns a^n modulo the CRC-32C polynomial. */
+uint32_t crc32c_pow(uint32_t a, size_t n);
+
+}  // namespace logging
+#endif
@@ -0,0 +1,22 @@
+#ifndef LOGGING_CRC32CHUGE_H__
+#define LOGGING_CRC32CHUGE_H__
+
+#include <cstddef>
+
+namespace logging {
+
+/** Size of the huge pages crc32cAllocHuge() backs buffers with. */
+static const size_t kCRC32CHugePageSize = 2 * 1024 * 1024;
+
+/** Allocates a buffer of size bytes, rounded up to whole huge pages and aligned
+to a huge page, for staging data that crc32c_hw_large() will read. Pages from the
+MAP_HUGETLB pool are used if any are reserved. Otherwise the mapping is advised
+to use transparent huge pages, which the kernel may or may not grant. Returns NULL
+if no memory could be mapped. */
+void* crc32cAllocHuge(size_t size);
+
+/** Frees a buffer from crc32cAllocHuge(); size is the size it was allocated with. */
+void crc32cFreeHuge(void* buffer, size_t size);
+
+}  // namespace logging
+#endif
@@ -0,0 +1,32 @@
+#ifndef LOGGING_CRC32CLOAD_H__
+#define LOGGING_CRC32CLOAD_H__
+
+#include <cstring>
+#include <stdint.h>
+
+namespace logging {
+
+// Unaligned loads for the kernels. Dereferencing a char buffer through a
+// uint32_t* or uint64_t* breaks strict aliasing and, when misaligned, alignment
+// rules; memcpy of a fixed size compiles to the same single mov.
+
+static inline uint16_t crc32c_load_u16(const void* p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t crc32c_load_u32(const void* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t crc32c_load_u64(const void* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+}  // namespace logging
+#endif
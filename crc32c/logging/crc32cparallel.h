@@ -0,0 +1,22 @@
+#ifndef LOGGING_CRC32CPARALLEL_H__
+#define LOGGING_CRC32CPARALLEL_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace logging {
+
+/** Computes the CRC32-C of a large buffer on several threads. Takes and returns
+the same values as a CRC32CFunctionPtr. The buffer is cut into chunks on 2 MiB
+boundaries. move_pages() tells which NUMA node holds the first page of each chunk,
+and a worker pinned to the CPUs of that node hashes the chunk with the best kernel.
+The chunk CRCs are joined with crc32cCombine(). A chunk whose node is unknown, e.g.
+because its pages are not faulted in yet, goes to any worker, and idle workers take
+chunks from other nodes once their own are done.
+@arg threads Number of threads, counting the caller; 0 means one per online CPU.
+Buffers too small for two chunks per thread use fewer threads, down to the caller
+alone. */
+uint32_t crc32cParallel(uint32_t crc, const void* data, size_t length, size_t threads);
+
+}  // namespace logging
+#endif
@@ -0,0 +1,57 @@
+#ifndef LOGGING_CRC32CROLLING_H__
+#define LOGGING_CRC32CROLLING_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+namespace logging {
+
+/** CRC32-C of the last window bytes of a stream, updated in O(1) per byte, for
+content-defined chunking and block matching. The CRC is kept from a zero start,
+where it is linear in the data: a byte leaving the window is taken out by xoring
+in its CRC followed by window zero bytes, looked up in a table built with
+crc32c_multiply(). The byte coming in goes through the crc32 instruction, or the
+Sarwate table without SSE4.2. value() is the ordinary CRC32-C of the window, the
+same as crc32cFinish(crc32c(crc32cInit(), window, length)). */
+class RollingCRC32C {
+public:
+    /** window is in bytes and must be at least 1. */
+    explicit RollingCRC32C(size_t window);
+
+    size_t window() const {
+        return window_;
+    }
+
+    /** Makes data[0, window) the window. */
+    void start(const void* data);
+
+    /** Moves the window one byte on: out is the oldest byte of the window, in
+    the byte after it. */
+    void roll(uint8_t out, uint8_t in);
+
+    /** CRC32-C of the window. */
+    uint32_t value() const {
+        return crc_ ^ finish_;
+    }
+
+    /** Appends to ends every end offset e, window <= e <= length, where the
+    window data[e - window, e) has (CRC32-C & mask) == 0, in increasing order.
+    Does not change the window of this object. Several stretches of data are
+    rolled at once, so the crc32 latency is hidden. */
+    void scan(const void* data, size_t length, uint32_t mask, std::vector<size_t>* ends) const;
+
+private:
+    size_t window_;
+    bool hasHardware_;
+    // CRC from zero of the window so far
+    uint32_t crc_;
+    // Turns crc_ into the CRC32-C of the window: the effect of the 0xFFFFFFFF
+    // start over window bytes, and the final inversion
+    uint32_t finish_;
+    // CRC from zero of byte b followed by window zero bytes
+    uint32_t out_[256];
+};
+
+}  // namespace logging
+#endif
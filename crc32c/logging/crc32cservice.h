@@ -0,0 +1,66 @@
+#ifndef LOGGING_CRC32CSERVICE_H__
+#define LOGGING_CRC32CSERVICE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "crc32c.h"
+
+namespace logging {
+
+/** Called on a worker thread with the final CRC32-C of a submitted buffer. */
+typedef void (*CRC32CCallback)(void* context, uint32_t crc);
+
+struct CRC32CServiceRing;
+struct CRC32CServiceWorker;
+struct CRC32CServiceBatch;
+
+/** Checksums buffers on worker threads, for callers such as network threads that
+should not spend their own time hashing large payloads. Each producer submits into
+its own single-producer single-consumer ring, so submit() takes no lock unless the
+worker is asleep. Every ring is drained by one worker, which takes a batch from each
+of its rings in one pass. Buffers of up to kSmallLength bytes in that pass, from all
+of the worker's rings, are hashed three at a time with crc32c_buffers(), which keeps
+the crc32 unit busy where each alone would leave it waiting on latency. Longer ones
+go to the kernel detectBestCRC32C() picks. The callbacks of one producer run in the
+order its buffers were submitted. An idle worker spins for a while and then sleeps
+until a producer of one of its rings submits again. */
+class CRC32CService {
+public:
+    /** Buffers up to this long are hashed together. Above it the folding kernels
+    beat three interleaved crc32 streams. */
+    static const size_t kSmallLength = 128;
+
+    /** producers is the number of submitting threads. Each worker is pinned to
+    the CPU in cpus, or not pinned for a negative entry; no entries means one
+    unpinned worker. ringSize is the number of items each ring holds, rounded up
+    to a power of two. */
+    CRC32CService(size_t producers, const std::vector<int>& cpus, size_t ringSize = 1024);
+
+    /** Waits for the workers to finish every submitted buffer. */
+    ~CRC32CService();
+
+    /** Queues length bytes at data for checksumming on behalf of producer, which
+    only one thread may use at a time. Returns false without queueing if the ring
+    is full. data must stay valid until callback has been called. */
+    bool submit(size_t producer, const void* data, size_t length, CRC32CCallback callback, void* context);
+
+private:
+    void work(size_t worker, int cpu);
+    size_t drain(const std::vector<CRC32CServiceRing*>& rings, CRC32CServiceBatch* batch);
+    void waitForWork(CRC32CServiceWorker* state, const std::vector<CRC32CServiceRing*>& rings);
+    static void wake(CRC32CServiceWorker* state);
+
+    CRC32CFunctionPtr crcfn_;
+    bool hasHardware_;
+    std::vector<CRC32CServiceRing*> rings_;
+    std::vector<CRC32CServiceWorker*> workerStates_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stop_;
+};
+
+}  // namespace logging
+#endif
@@ -0,0 +1,46 @@
+#ifndef LOGGING_CRC32CSTATS_H__
+#define LOGGING_CRC32CSTATS_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+#include "crc32c.h"
+
+namespace logging {
+
+/** Length buckets: bucket 0 counts empty buffers, bucket k counts lengths from
+2^(k-1) to 2^k - 1 bytes. */
+static const size_t kCRC32CStatsBuckets = 65;
+
+/** Calls made through logging::crc32c while counting was on, summed over all
+threads, including threads that have exited. */
+struct CRC32CStats {
+    /** Kernel that logging::crc32c runs, i.e. detectBestCRC32C(). */
+    CRC32CFunctionPtr kernel;
+    /** Name of kernel, e.g. "crc32cHardware64". */
+    const char* kernelName;
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t lengths[kCRC32CStatsBuckets];
+};
+
+/** Turns counting on or off. On, logging::crc32c points at a wrapper that counts
+into a block owned by the calling thread and then calls the kernel. Off, it points
+straight at the kernel again, so counting costs nothing until it is turned on.
+Setting the environment variable CRC32C_STATS to 1 turns it on at the first call
+of logging::crc32c. Counts are kept while it is off. */
+void crc32cStatsEnable(bool enable);
+
+/** Returns true if counting is on. */
+bool crc32cStatsEnabled();
+
+/** Returns the counts so far. Other threads may be counting while it runs, so each
+counter is exact but they need not be from the same instant. */
+CRC32CStats crc32cStatsSnapshot();
+
+/** Returns the kernel to run for logging::crc32c, given the one detectBestCRC32C()
+picked: the counting wrapper if counting was asked for, else best itself. */
+CRC32CFunctionPtr crc32cStatsSelect(CRC32CFunctionPtr best);
+
+}  // namespace logging
+#endif
@@ -0,0 +1,134 @@
+#ifndef LOGGING_CRC32CTAIL_H__
+#define LOGGING_CRC32CTAIL_H__
+
+#include <cstddef>
+#include <stdint.h>
+#include <x86intrin.h>
+
+#include "crc32c.h"
+#include "crc32cload.h"
+
+namespace logging {
+
+// Leading and trailing bytes shared by the hardware kernels. A run of n < 8 bytes
+// is placed in the top n bytes of a quadword whose other bytes are zero, so that
+// crc32q of the word from zero is the crc of just those bytes. The crc that came
+// before them is moved over the n bytes with one pclmulqdq and folded into the same
+// crc32q. That takes one quadword load (two for buffers under 8 bytes) and no
+// branch on the number of bytes.
+//
+// The crc32c_shift_* variants do the same with the crc32 instruction alone, for
+// kernels that must run on SSE4.2 CPUs without PCLMULQDQ. In a loop of 8..23 byte
+// calls they took about 10 ns a call against 8.6 for the fold (and 22 for a
+// bit-test ladder), so kernels that have PCLMULQDQ anyway keep the fold.
+
+// x^(8 * n - 32) mod P for n = 0..7, in reversed bit order shifted left by one
+// for pclmulqdq, like crc32c_clmul_constants.
+static const uint64_t crc32c_tail_constants[8] = {
+    0x1ac21acfcULL, 0x1ba6df7f8ULL, 0x17de12cbcULL, 0x1fbc72ac4ULL,
+    0x100000000ULL, 0x001000000ULL, 0x000010000ULL, 0x000000100ULL
+};
+
+/** Returns crc extended by the n (0..7) bytes held in the top n bytes of word.
+The other bytes of word must be zero. */
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_fold_bytes(uint32_t crc, uint64_t word, size_t n) {
+    const __m128i multiplier = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(&crc32c_tail_constants[n]));
+    const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int32_t)crc), multiplier, 0x00);
+#ifdef __x86_64__
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(product) ^ word);
+#else
+    uint32_t low = (uint32_t)_mm_cvtsi128_si32(product) ^ (uint32_t)word;
+    uint32_t high = (uint32_t)_mm_extract_epi32(product, 1) ^ (uint32_t)(word >> 32);
+    return _mm_crc32_u32(_mm_crc32_u32(0, low), high);
+#endif
+}
+
+/** crc32c_fold_bytes with crc32 only. crc is xored into the word just below the
+n data bytes, so the crc32q from zero advances it over them. For n < 4 its top
+4 - n bytes do not fit in the quadword; n bytes only shift those down, so they
+are xored in after. */
+CRC32C_TARGET_SSE42
+static inline uint32_t crc32c_shift_bytes(uint32_t crc, uint64_t word, size_t n) {
+    uint64_t shifted = (((uint64_t)crc << (8 * (7 - n))) << 8) ^ word;
+    uint32_t rest = (uint32_t)((uint64_t)crc >> (8 * n));
+#ifdef __x86_64__
+    return (uint32_t)_mm_crc32_u64(0, shifted) ^ rest;
+#else
+    return _mm_crc32_u32(_mm_crc32_u32(0, (uint32_t)shifted), (uint32_t)(shifted >> 32)) ^ rest;
+#endif
+}
+
+/** The n (0..7) bytes at data in the top n bytes of a quadword, the rest zero. The
+8 bytes from data on must be readable. */
+static inline uint64_t crc32c_head_word(const char * data, size_t n) {
+    return (crc32c_load_u64(data) << (8 * (7 - n))) << 8;
+}
+
+/** The n (0..7) bytes that end at end in the top n bytes of a quadword, the rest
+zero. The 8 bytes before end must be readable. */
+static inline uint64_t crc32c_tail_word(const char * end, size_t n) {
+    return crc32c_load_u64(end - 8) & ((~0ULL << (8 * (7 - n))) << 8);
+}
+
+/** A whole buffer of 1..7 bytes in the top length bytes of a quadword, the rest
+zero. Only the length class (1..3, 4..7) is branched on. */
+static inline uint64_t crc32c_short_word(const char * data, size_t length) {
+    if (length >= 4) {
+        // Two overlapping dwords; the bytes they share are equal
+        return ((uint64_t)crc32c_load_u32(data + length - 4) << 32) |
+               ((uint64_t)crc32c_load_u32(data) << (8 * (8 - length)));
+    }
+    // First, middle and last byte cover all of 1..3 bytes
+    return ((uint64_t)(uint8_t)data[0] << (8 * (8 - length))) |
+           ((uint64_t)(uint8_t)data[length >> 1] << (8 * (8 - length + (length >> 1)))) |
+           ((uint64_t)(uint8_t)data[length - 1] << 56);
+}
+
+/** Returns crc extended by the n (0..7) bytes at data. The 8 bytes from data on
+must be readable. */
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_hw_head(uint32_t crc, const char * data, size_t n) {
+    return crc32c_fold_bytes(crc, crc32c_head_word(data, n), n);
+}
+
+/** Returns crc extended by the n (0..7) bytes that end at end. The 8 bytes
+before end must be readable. */
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_hw_tail(uint32_t crc, const char * end, size_t n) {
+    return crc32c_fold_bytes(crc, crc32c_tail_word(end, n), n);
+}
+
+/** Returns crc extended by a whole buffer of less than 8 bytes. Only the length
+class (0, 1..3, 4..7) is branched on. */
+CRC32C_TARGET_HW
+static inline uint32_t crc32c_hw_short(uint32_t crc, const char * data, size_t length) {
+    if (length == 0) {
+        return crc;
+    }
+    return crc32c_fold_bytes(crc, crc32c_short_word(data, length), length);
+}
+
+/** crc32c_hw_head with crc32 only. */
+CRC32C_TARGET_SSE42
+static inline uint32_t crc32c_shift_head(uint32_t crc, const char * data, size_t n) {
+    return crc32c_shift_bytes(crc, crc32c_head_word(data, n), n);
+}
+
+/** crc32c_hw_tail with crc32 only. */
+CRC32C_TARGET_SSE42
+static inline uint32_t crc32c_shift_tail(uint32_t crc, const char * end, size_t n) {
+    return crc32c_shift_bytes(crc, crc32c_tail_word(end, n), n);
+}
+
+/** crc32c_hw_short with crc32 only. */
+CRC32C_TARGET_SSE42
+static inline uint32_t crc32c_shift_short(uint32_t crc, const char * data, size_t length) {
+    if (length == 0) {
+        return crc;
+    }
+    return crc32c_shift_bytes(crc, crc32c_short_word(data, length), length);
+}
+
+}  // namespace logging
+#endif
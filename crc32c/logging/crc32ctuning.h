@@ -0,0 +1,42 @@
+#ifndef LOGGING_CRC32CTUNING_H__
+#define LOGGING_CRC32CTUNING_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace logging {
+
+/** Block sizes used by the multi-stream kernels. The best values depend on the
+latency and throughput of crc32 and pclmulqdq, so they are chosen per
+microarchitecture from CPUID. */
+struct CRC32CTuning {
+    /** Microarchitecture the values were chosen for. */
+    const char* name;
+    /** crc32cAdler LONG block in bytes; a power of two, at least 32. */
+    size_t adlerLong;
+    /** crc32cAdler SHORT block in bytes; a power of two, at least 32. */
+    size_t adlerShort;
+    /** __crc32c_hw_u64 stream length in quadwords, 1..128. */
+    size_t hwMaxBlock;
+    /** crc32cIntelC Duff's device block in triplets, 1..128. */
+    size_t intelMaxBlock;
+    /** crc32cIntelC only uses triplets above this many bytes; at most 216. */
+    size_t intelSmallSize;
+    /** SMALL_SIZE of crc_pcl; at most 255. */
+    size_t pclSmallSize;
+    /** How far ahead of each stream crc32c_hw_prefetch prefetches, in bytes; a
+    multiple of 64, 64..4096. */
+    size_t prefetchDistance;
+};
+
+/** Returns the tuning for the CPU we are running on. CPUID is read on the
+first call; the result never changes afterwards. The environment variable
+CRC32C_TUNING can name a row to use instead, e.g. "Zen 3". */
+const CRC32CTuning& crc32cTuning();
+
+/** Returns the tuning for a CPUID family and model (as displayed, i.e. with the
+extended family and model folded in). Unknown parts get the Nehalem values. */
+const CRC32CTuning& crc32cTuningFor(bool amd, unsigned family, unsigned model);
+
+}  // namespace logging
+#endif
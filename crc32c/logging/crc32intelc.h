@@ -48,87 +48,74 @@
 
 #ifndef __LP64__
 #define CRCtriplet(crc, buf, offset) \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *((uint32_t*) buf ## 0 + 2 * offset)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *((uint32_t*) buf ## 1 + 2 * offset)); \
-    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, *((uint32_t*) buf ## 2 + 2 * offset)); \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *((uint32_t*) buf ## 0 + 1 + 2 * offset)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *((uint32_t*) buf ## 1 + 1 + 2 * offset)); \
-    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, *((uint32_t*) buf ## 2 + 1 + 2 * offset));
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32((const uint32_t*) buf ## 0 + 2 * offset)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32((const uint32_t*) buf ## 1 + 2 * offset)); \
+    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, crc32c_load_u32((const uint32_t*) buf ## 2 + 2 * offset)); \
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32((const uint32_t*) buf ## 0 + 1 + 2 * offset)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32((const uint32_t*) buf ## 1 + 1 + 2 * offset)); \
+    crc ## 2 = __builtin_ia32_crc32si(crc ## 2, crc32c_load_u32((const uint32_t*) buf ## 2 + 1 + 2 * offset));
 #else
 #define CRCtriplet(crc, buf, offset) \
-    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, *(buf ## 0 + offset)); \
-    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, *(buf ## 1 + offset)); \
-    crc ## 2 = __builtin_ia32_crc32di(crc ## 2, *(buf ## 2 + offset));
+    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, crc32c_load_u64(buf ## 0 + offset)); \
+    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, crc32c_load_u64(buf ## 1 + offset)); \
+    crc ## 2 = __builtin_ia32_crc32di(crc ## 2, crc32c_load_u64(buf ## 2 + offset));
 #endif
 
 #ifndef __LP64__
 #define CRCduplet(crc, buf, offset) \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *((uint32_t*) buf ## 0 + 2 * offset)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *((uint32_t*) buf ## 1 + 2 * offset)); \
-    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, *((uint32_t*) buf ## 0 + 1 + 2 * offset)); \
-    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, *((uint32_t*) buf ## 1 + 1 + 2 * offset));
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32((const uint32_t*) buf ## 0 + 2 * offset)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32((const uint32_t*) buf ## 1 + 2 * offset)); \
+    crc ## 0 = __builtin_ia32_crc32si(crc ## 0, crc32c_load_u32((const uint32_t*) buf ## 0 + 1 + 2 * offset)); \
+    crc ## 1 = __builtin_ia32_crc32si(crc ## 1, crc32c_load_u32((const uint32_t*) buf ## 1 + 1 + 2 * offset));
 #else
 #define CRCduplet(crc, buf, offset) \
-    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, *(buf ## 0 + offset)); \
-    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, *(buf ## 1 + offset));
+    crc ## 0 = __builtin_ia32_crc32di(crc ## 0, crc32c_load_u64(buf ## 0 + offset)); \
+    crc ## 1 = __builtin_ia32_crc32di(crc ## 1, crc32c_load_u64(buf ## 1 + offset));
 #endif
 
 
 #ifndef __LP64__
 #define CRCsinglet(crc, buf, offset) \
-    crc = __builtin_ia32_crc32si(crc, *(uint32_t*)(buf + offset)); \
-    crc = __builtin_ia32_crc32si(crc, *(uint32_t*)(buf + offset + sizeof(uint32_t)));
+    crc = __builtin_ia32_crc32si(crc, crc32c_load_u32(buf + offset)); \
+    crc = __builtin_ia32_crc32si(crc, crc32c_load_u32(buf + offset + sizeof(uint32_t)));
 #else
-#define CRCsinglet(crc, buf, offset) crc = __builtin_ia32_crc32di(crc, *(uint64_t*)(buf + offset));
+#define CRCsinglet(crc, buf, offset) crc = __builtin_ia32_crc32di(crc, crc32c_load_u64(buf + offset));
 #endif
 
 
 /*
- * CombineCRC performs pclmulqdq multiplication of 2 partial CRC's and a well chosen constant 
- * and xor's these with the remaining CRC. I (Ferry Toth) could not find a way to implement this in
- * C, so the 64bit code following here is from Intel. As that code runs only on 64 bit (due to movq
- * instructions), I am providing a 32bit variant that does the same but using movd. The 32bit
- * version keeps intermediate results longer in the xmm registers to do the 2nd xor, then moves the
- * longs in 2 steps for the final crc32l
- * 
-*/
+ * CombineCRC performs pclmulqdq multiplication of 2 partial CRC's and a well chosen constant
+ * and xor's these with the remaining CRC. This used to be inline assembly from Intel (with a
+ * 32bit variant using movd), which the compiler could neither schedule nor inline. With
+ * intrinsics the combine of one block overlaps with the crc32 stream of the next, and the
+ * constants in K are loaded unaligned. On 32 bit the 64 bit product is folded in with 2 crc32l.
+ */
+
+#include <x86intrin.h>
+#include "crc32c.h"
+#include "crc32cload.h"
+
+namespace logging
+{
 
+extern __v2di K[];
+
+CRC32C_TARGET_HW
+static inline CRC_NATIVE CombineCRC ( size_t block_size, CRC_NATIVE crc0, CRC_NATIVE crc1, CRC_NATIVE crc2, const uint64_t *next2 )
+{
+        const __m128i multiplier = _mm_loadu_si128 ( ( const __m128i* ) ( K + block_size - 1 ) );
+        const __m128i result0 = _mm_clmulepi64_si128 ( _mm_cvtsi32_si128 ( ( int ) crc0 ), multiplier, 0x00 );
+        const __m128i result1 = _mm_clmulepi64_si128 ( _mm_cvtsi32_si128 ( ( int ) crc1 ), multiplier, 0x10 );
+        const __m128i result = _mm_xor_si128 ( result0, result1 );
 #ifndef __LP64__
-#define CombineCRC()\
-asm volatile (\
-"movdqu (%3), %%xmm0\n\t"\
-"movd %0, %%xmm1\n\t"\
-"pclmullqlqdq %%xmm0, %%xmm1\n\t"\
-"movd %2, %%xmm2\n\t"\
-"pclmullqhqdq %%xmm0, %%xmm2\n\t"\
-"pxor %%xmm2, %%xmm1\n\t"\
-"movdqu (%4), %%xmm2\n\t"\
-"pxor %%xmm2, %%xmm1\n\t"\
-"movd %%xmm1, %0\n\t"\
-"crc32l %0, %5\n\t"\
-"pextrd $1, %%xmm1, %1\n\t"\
-"crc32l %1, %5\n\t"\
-"movl %5, %0"\
-: "=r" ( crc0 )\
-: "0" ( crc0 ), "r" ( crc1 ), "r" ( K + block_size - 1 ), "r" ( ( uint64_t* ) next2 - 1 ), "r" ( crc2 )\
-: "%xmm0", "%xmm1", "%xmm2"\
-);
+        const unsigned char *last = ( const unsigned char* ) ( next2 - 1 );
+        crc2 = __builtin_ia32_crc32si ( crc2, ( uint32_t ) _mm_cvtsi128_si32 ( result ) ^ crc32c_load_u32 ( last ) );
+        return __builtin_ia32_crc32si ( crc2, ( uint32_t ) _mm_extract_epi32 ( result, 1 ) ^ crc32c_load_u32 ( last + 4 ) );
 #else
-#define CombineCRC()\
-asm volatile (\
-"movdqa (%3), %%xmm0\n\t"\
-"movq %0, %%xmm1\n\t"\
-"pclmullqlqdq %%xmm0, %%xmm1\n\t"\
-"movq %2, %%xmm2\n\t"\
-"pclmullqhqdq %%xmm0, %%xmm2\n\t"\
-"pxor %%xmm2, %%xmm1\n\t"\
-"movq %%xmm1, %0"\
-: "=r" ( crc0 ) \
-: "0" ( crc0 ), "r" ( crc1 ), "r" ( K + block_size - 1 ) \
-: "%xmm0", "%xmm1", "%xmm2"\
-); \
-crc0 = crc0 ^ * ( ( uint64_t* ) next2 - 1 );\
-crc2 = __builtin_ia32_crc32di ( crc2, crc0 );\
-crc0 = crc2;
+        return __builtin_ia32_crc32di ( crc2, ( uint64_t ) _mm_cvtsi128_si64 ( result ) ^ crc32c_load_u64 ( next2 - 1 ) );
 #endif
+}
+
+}  // namespace logging
+
 // kate: indent-mode cstyle; indent-width 4; replace-tabs on; 
@@ -0,0 +1,147 @@
+#ifndef LOGGING_ENERGYCOUNTERS_H__
+#define LOGGING_ENERGYCOUNTERS_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+namespace logging {
+
+/** Package and core energy from the Linux powercap RAPL interface in sysfs,
+summed over all packages. RAPL counts for the whole package, so anything else
+running on the machine is included. energy_uj is only readable by root on
+kernels since 5.10; a domain that cannot be read is left out, and available()
+says so. */
+class EnergyCounters {
+public:
+    enum Domain {
+        PACKAGE,
+        CORE,
+        NUM_DOMAINS
+    };
+
+    EnergyCounters() : numZones_(0) {
+        // intel-rapl:N is package N (AMD parts use the same name), and
+        // intel-rapl:N:M are its parts, one of which is named "core"
+        for (int package = 0; package < kMaxPackages; ++package) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d", package);
+            if (!addZone(PACKAGE, path)) {
+                break;
+            }
+            for (int part = 0; part < kMaxParts; ++part) {
+                char name[32];
+                snprintf(path, sizeof(path), "/sys/class/powercap/intel-rapl:%d:%d", package, part);
+                if (readName(path, name, sizeof(name)) && strcmp(name, "core") == 0) {
+                    addZone(CORE, path);
+                }
+            }
+        }
+        for (int i = 0; i < NUM_DOMAINS; ++i) {
+            joules_[i] = 0;
+        }
+    }
+
+    bool available(Domain domain) const {
+        for (int i = 0; i < numZones_; ++i) {
+            if (zones_[i].domain == domain) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool anyAvailable() const {
+        return numZones_ > 0;
+    }
+
+    void start() {
+        for (int i = 0; i < numZones_; ++i) {
+            zones_[i].start = readMicrojoules(zones_[i].energyPath);
+        }
+    }
+
+    void end() {
+        for (int i = 0; i < NUM_DOMAINS; ++i) {
+            joules_[i] = 0;
+        }
+        for (int i = 0; i < numZones_; ++i) {
+            uint64_t now = readMicrojoules(zones_[i].energyPath);
+            // The counter wraps at max_energy_range_uj, every few minutes under load
+            uint64_t used = now >= zones_[i].start ? now - zones_[i].start : now + zones_[i].range - zones_[i].start;
+            joules_[zones_[i].domain] += used / 1e6;
+        }
+    }
+
+    /** Joules used in domain between start() and end(). */
+    double get(Domain domain) const {
+        return joules_[domain];
+    }
+
+private:
+    static const int kMaxPackages = 8;
+    static const int kMaxParts = 4;
+
+    struct Zone {
+        Domain domain;
+        char energyPath[160];
+        uint64_t range;
+        uint64_t start;
+    };
+
+    bool addZone(Domain domain, const char* path) {
+        if (numZones_ == kMaxPackages * 2) {
+            return false;
+        }
+        Zone& zone = zones_[numZones_];
+        snprintf(zone.energyPath, sizeof(zone.energyPath), "%s/energy_uj", path);
+        char rangePath[160];
+        snprintf(rangePath, sizeof(rangePath), "%s/max_energy_range_uj", path);
+        zone.domain = domain;
+        zone.range = readMicrojoules(rangePath);
+        zone.start = 0;
+        // Missing, or there but not readable
+        FILE* file = fopen(zone.energyPath, "r");
+        if (file == NULL) {
+            return false;
+        }
+        fclose(file);
+        ++numZones_;
+        return true;
+    }
+
+    static bool readName(const char* path, char* name, size_t size) {
+        char namePath[160];
+        snprintf(namePath, sizeof(namePath), "%s/name", path);
+        FILE* file = fopen(namePath, "r");
+        if (file == NULL) {
+            return false;
+        }
+        bool found = fgets(name, (int) size, file) != NULL;
+        fclose(file);
+        if (found) {
+            name[strcspn(name, "\n")] = '\0';
+        }
+        return found;
+    }
+
+    static uint64_t readMicrojoules(const char* path) {
+        unsigned long long value = 0;
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            return 0;
+        }
+        if (fscanf(file, "%llu", &value) != 1) {
+            value = 0;
+        }
+        fclose(file);
+        return value;
+    }
+
+    Zone zones_[kMaxPackages * 2];
+    int numZones_;
+    double joules_[NUM_DOMAINS];
+};
+
+}
+#endif
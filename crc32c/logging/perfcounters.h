@@ -0,0 +1,143 @@
+#ifndef LOGGING_PERFCOUNTERS_H__
+#define LOGGING_PERFCOUNTERS_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace logging {
+
+/** Hardware counters of the calling thread, and of threads it starts, through
+perf_event_open. Each event is opened on its own, so a PMU with fewer counters
+than events multiplexes them and the counts are scaled by the time each one ran.
+An event the kernel refuses (no PMU in a VM, perf_event_paranoid, not Linux) is
+left out, and available() says so. */
+class PerfCounters {
+public:
+    enum Event {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        LLC_MISSES,
+        DTLB_MISSES,
+        NUM_EVENTS
+    };
+
+    PerfCounters() {
+        for (int i = 0; i < NUM_EVENTS; ++i) {
+            fds_[i] = open((Event) i);
+            start_[i] = end_[i] = 0;
+        }
+    }
+
+    ~PerfCounters() {
+        for (int i = 0; i < NUM_EVENTS; ++i) {
+            if (fds_[i] >= 0) {
+                close(fds_[i]);
+            }
+        }
+    }
+
+    bool available(Event event) const {
+        return fds_[event] >= 0;
+    }
+
+    bool anyAvailable() const {
+        for (int i = 0; i < NUM_EVENTS; ++i) {
+            if (available((Event) i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void start() {
+        read(start_);
+    }
+
+    void end() {
+        read(end_);
+    }
+
+    /** Count of event between start() and end(). */
+    double get(Event event) const {
+        return end_[event] - start_[event];
+    }
+
+private:
+    PerfCounters(const PerfCounters&);
+    PerfCounters& operator=(const PerfCounters&);
+
+#ifdef __linux__
+    static int open(Event event) {
+        static const struct {
+            uint32_t type;
+            uint64_t config;
+        } kEvents[NUM_EVENTS] = {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        };
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = kEvents[event].type;
+        attr.config = kEvents[event].config;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // User space only, which perf_event_paranoid 2 still allows; the kernels
+        // never enter the kernel
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    void read(double* counts) const {
+        for (int i = 0; i < NUM_EVENTS; ++i) {
+            uint64_t values[3];  // value, time enabled, time running
+            if (fds_[i] < 0 || ::read(fds_[i], values, sizeof(values)) != sizeof(values)) {
+                counts[i] = 0;
+                continue;
+            }
+            counts[i] = values[2] == 0 ? 0 : (double) values[0] * values[1] / values[2];
+        }
+    }
+
+    static void close(int fd) {
+        ::close(fd);
+    }
+#else
+    static int open(Event) {
+        return -1;
+    }
+
+    void read(double* counts) const {
+        for (int i = 0; i < NUM_EVENTS; ++i) {
+            counts[i] = 0;
+        }
+    }
+
+    static void close(int) {
+    }
+#endif
+
+    int fds_[NUM_EVENTS];
+    double start_[NUM_EVENTS];
+    double end_[NUM_EVENTS];
+};
+
+}
+#endif